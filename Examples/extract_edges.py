@@ -0,0 +1,36 @@
+import time
+import numpy as np
+import nimbusrt as nrt
+import nimbusrt.io as io
+
+
+def edge_matches(edge, reference, max_distance=0.05, min_cos_angle=0.98):
+    direction = edge.end - edge.start
+    length = np.linalg.norm(direction)
+    direction /= length
+    if np.abs(np.dot(direction, reference.forward)) < min_cos_angle:
+        return False
+    mid = (reference.start + reference.end) * 0.5 - edge.start
+    t = np.dot(mid, direction)
+    return -max_distance <= t <= length + max_distance and np.linalg.norm(mid - t * direction) < max_distance
+
+
+if __name__ == "__main__":
+    scene = nrt.Scene()
+    scene.set_point_cloud("Data/SyntheticCorridor.ply")
+    reference_edges = io.read_edges_from_json("Data/SyntheticCorridorEdges.json")
+
+    settings = nrt.EdgeExtractionSettings()
+    settings.voxel_size = 0.1
+    settings.min_edge_angle = 20.0
+    settings.min_edge_length = 0.1
+
+    start = time.perf_counter()
+    edges = scene.extract_edges(settings)
+    elapsed = time.perf_counter() - start
+
+    found = sum(any(edge_matches(edge, reference) for edge in edges) for reference in reference_edges)
+    matched = sum(any(edge_matches(edge, reference) for reference in reference_edges) for edge in edges)
+    print(f"Extracted {len(edges)} edges in {elapsed * 1000.0:.1f} ms.")
+    print(f"Reference edges found: {found}/{len(reference_edges)}, extracted edges matching a reference: {matched}/{len(edges)}.")
+    io.write_edges_to_json("Data/SyntheticCorridorExtractedEdges.json", edges)
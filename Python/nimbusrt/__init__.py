@@ -1,3 +1,3 @@
 from .edge import Edge, EdgeHelper
 from .scene import Scene
-from ._C import InputData
+from ._C import InputData, EdgeExtractionSettings
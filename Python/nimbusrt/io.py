@@ -11,7 +11,14 @@ def read_edges_from_json(filename):
 def write_edges_to_json(filename, edges):
     json_string = json.dumps(
         [
-            EdgeHelper(ob.start, ob.end, ob.normal0, ob.normal1, 0, 0).__dict__
+            EdgeHelper(
+                ob.start,
+                ob.end,
+                ob.edge_face0.normal,
+                ob.edge_face1.normal,
+                ob.material_index0,
+                ob.material_index1,
+            ).__dict__
             for ob in edges
         ]
     )
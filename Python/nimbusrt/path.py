@@ -1,13 +1,13 @@
 import numpy as np
-from ._C import NativeTraceData, NativeInteraction, NativeInteractionType
+from ._C import NativePackedPaths, NativeInteractionType
 
 
 class Interaction:
-    def __init__(self, ia: NativeInteraction, edge_or_material):
-        self._label = ia.label
-        self._type = ia.type
-        self._position = ia.position
-        self._normal = ia.normal
+    def __init__(self, record, ia_type: NativeInteractionType, edge_or_material):
+        self._label = int(record["label"])
+        self._type = ia_type
+        self._position = np.array([record["x"], record["y"], record["z"]])
+        self._normal = np.array([record["nx"], record["ny"], record["nz"]])
         self._edge_or_material = edge_or_material
 
     @property
@@ -36,19 +36,21 @@ class Interaction:
 
 
 class Path:
-    def __init__(self, path: NativeTraceData, materials, edges):
-        self._interactions = np.empty(path.num_interactions, dtype=Interaction)
-        self._time_delay = path.time_delay
-        index = 0
-        for ia_index in range(path.num_interactions):
-            ia = path.interactions[ia_index]
-            if ia.type == NativeInteractionType.REFLECTION:
-                self._interactions[index] = Interaction(ia, materials[ia.materialID])
-            elif ia.type == NativeInteractionType.DIFFRACTION:
-                self._interactions[index] = Interaction(ia, edges[ia.label])
+    def __init__(self, header, interactions, materials, edges):
+        num_interactions = int(header["num_interactions"])
+        first_interaction = int(header["first_interaction"])
+        types = int(header["types"])
+        self._interactions = np.empty(num_interactions, dtype=Interaction)
+        self._time_delay = float(header["time_delay"])
+        for index in range(num_interactions):
+            record = interactions[first_interaction + index]
+            ia_type = NativeInteractionType((types >> (2 * index)) & 3)
+            if ia_type == NativeInteractionType.REFLECTION:
+                self._interactions[index] = Interaction(record, ia_type, materials[record["material"]])
+            elif ia_type == NativeInteractionType.DIFFRACTION:
+                self._interactions[index] = Interaction(record, ia_type, edges[record["label"]])
             else:
-                assert False, f"Bad interaction type: {ia.type}"
-            index += 1
+                assert False, f"Bad interaction type: {ia_type}"
 
     @property
     def interactions(self):
@@ -68,8 +70,10 @@ class PathStorage:
         for tx in paths:
             self._paths[tx] = {}
             for rx in paths[tx]:
+                packed_paths: NativePackedPaths = paths[tx][rx]
+                interactions = packed_paths.interactions
                 self._paths[tx][rx] = np.array(
-                    [Path(trace_data, materials, edges) for trace_data in paths[tx][rx]]
+                    [Path(header, interactions, materials, edges) for header in packed_paths.headers]
                 )
 
     def __getitem__(self, tx_name):
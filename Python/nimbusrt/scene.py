@@ -7,6 +7,7 @@ from ._C import (
     InputData,
     NativeObject3D,
     NativeEdge,
+    EdgeExtractionSettings,
 )
 from plyfile import PlyData
 from .io import load_point_cloud
@@ -78,6 +79,21 @@ class Scene(NativeScene):
                 edge.link_materials(self._materials)
             self._edges.append(edge)
 
+    def extract_edges(self, settings: EdgeExtractionSettings = None):
+        if settings is None:
+            settings = EdgeExtractionSettings()
+        return [
+            Edge(
+                edge.start,
+                edge.end,
+                edge.normal0,
+                edge.normal1,
+                edge.material0,
+                edge.material1,
+            )
+            for edge in super()._extract_edges(self._native_point_cloud(), settings)
+        ]
+
     @property
     def path_storage(self):
         return self._path_storage
@@ -86,16 +102,18 @@ class Scene(NativeScene):
     def materials(self):
         return self._materials
 
-    def compute_paths(self, input_data: InputData):
+    def _native_point_cloud(self):
         number_of_points = self._point_cloud["vertex"].data.shape[0]
         rt_point_cloud = np.empty(number_of_points, dtype=self._types)
         for t in self._types:
             rt_point_cloud[t[0]] = self._point_cloud["vertex"][t[0]]
+        return rt_point_cloud
 
+    def compute_paths(self, input_data: InputData):
         self._path_storage = PathStorage(
             super()._compute_paths(
                 input_data,
-                rt_point_cloud,
+                self._native_point_cloud(),
                 self._native_edges,
                 self._native_transmitters,
                 self._native_receivers,
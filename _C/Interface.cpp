@@ -10,12 +10,13 @@
 #include "KernelData.hpp"
 #include "VoxelConeTracer.hpp"
 #include "InputData.hpp"
+#include "EdgeExtractor.hpp"
 #include <glm/gtx/matrix_operation.hpp>
 #include <Utils.hpp>
 
 namespace py = pybind11;
 
-using PathData = std::unordered_map<std::string, std::unordered_map<std::string, std::vector<VCT::TraceData>>>;
+using PathData = std::unordered_map<std::string, std::unordered_map<std::string, VCT::PackedPaths>>;
 
 class Scene
 {
@@ -38,13 +39,13 @@ public:
 		if (coneTracer.Prepare(points, static_cast<size_t>(pointCloud.size()), input, txs, rxs, edges))
 		{
 			coneTracer.Trace();
+			coneTracer.RefineAll();
 			for (uint32_t txID = 0; txID < txs.size(); ++txID)
 			{
 				const std::string& txName = coneTracer.GetTransmitterName(txID);
 				for (uint32_t rxID = 0; rxID < rxs.size(); ++rxID)
 				{
 					const std::string& rxName = coneTracer.GetReceiverName(rxID);
-					coneTracer.Refine(txID, rxID);
 					if (auto paths = coneTracer.GetRefinedPathStorage().GetPaths(txID, rxID))
 					{
 						result[txName][rxName] = *paths;
@@ -54,8 +55,22 @@ public:
 		}
 		return result;
 	}
+
+	std::vector<VCT::ExtractedEdge> ExtractEdges(py::array_t<VCT::PointData, py::array::c_style | py::array::forcecast> pointCloud,
+												 const VCT::EdgeExtractionSettings& settings)
+	{
+		py::buffer_info bufferInfo = pointCloud.request();
+		const VCT::PointData* points = static_cast<VCT::PointData*>(bufferInfo.ptr);
+		py::gil_scoped_release release;
+		return VCT::ExtractEdges(points, static_cast<size_t>(pointCloud.size()), settings);
+	}
 };
 
+static VCT::V3 ToArray(const glm::vec3& v)
+{
+	return { v.x, v.y, v.z };
+}
+
 
 PYBIND11_MODULE(_C, m)
 {
@@ -71,6 +86,10 @@ PYBIND11_MODULE(_C, m)
 	m.doc() = "NimbusRT native code module.";
 	
 	PYBIND11_NUMPY_DTYPE(VCT::PointData, position.x, position.y, position.z, normal.x, normal.y, normal.z, label, material);
+	PYBIND11_NUMPY_DTYPE_EX(VCT::PackedPathHeader, transmitterID, "transmitter_id", receiverID, "receiver_id", timeDelay, "time_delay",
+							numInteractions, "num_interactions", types, "types", firstInteraction, "first_interaction");
+	PYBIND11_NUMPY_DTYPE_EX(VCT::PackedInteraction, position.x, "x", position.y, "y", position.z, "z", normal.x, "nx", normal.y, "ny", normal.z, "nz",
+							ieID, "ie_id", label, "label", materialID, "material", curvature, "curvature");
 
 	auto iaEnum = py::enum_<VCT::InteractionType>(m, "NativeInteractionType")
 		.value("DIFFRACTION", VCT::InteractionType::Diffraction)
@@ -90,6 +109,18 @@ PYBIND11_MODULE(_C, m)
 		.def_readwrite("time_delay", &VCT::TraceData::timeDelay)
 		.def_readwrite("interactions", &VCT::TraceData::interactions);
 
+	auto packedPaths = py::class_<VCT::PackedPaths>(m, "NativePackedPaths")
+		.def("__len__", &VCT::PackedPaths::Size)
+		.def_property_readonly("num_bytes", [](const VCT::PackedPaths& paths) { return paths.GetNumBytes(); })
+		.def_property_readonly("headers", [](const VCT::PackedPaths& paths)
+		{
+			return py::array_t<VCT::PackedPathHeader>(paths.GetHeaders().size(), paths.GetHeaders().data());
+		})
+		.def_property_readonly("interactions", [](const VCT::PackedPaths& paths)
+		{
+			return py::array_t<VCT::PackedInteraction>(paths.GetInteractions().size(), paths.GetInteractions().data());
+		});
+
 	auto edge = py::class_<VCT::Edge>(m, "NativeEdge")
 		.def(py::init<const VCT::V3&,
 					  const VCT::V3&,
@@ -98,7 +129,27 @@ PYBIND11_MODULE(_C, m)
 
 	auto scene = py::class_<Scene>(m, "NativeScene")
 		.def(py::init<>())
-		.def("_compute_paths", &Scene::ComputePaths);
+		.def("_compute_paths", &Scene::ComputePaths)
+		.def("_extract_edges", &Scene::ExtractEdges);
+
+	auto extractedEdge = py::class_<VCT::ExtractedEdge>(m, "NativeExtractedEdge")
+		.def_property_readonly("start", [](const VCT::ExtractedEdge& e) { return ToArray(e.start); })
+		.def_property_readonly("end", [](const VCT::ExtractedEdge& e) { return ToArray(e.end); })
+		.def_property_readonly("normal0", [](const VCT::ExtractedEdge& e) { return ToArray(e.normal0); })
+		.def_property_readonly("normal1", [](const VCT::ExtractedEdge& e) { return ToArray(e.normal1); })
+		.def_readonly("material0", &VCT::ExtractedEdge::material0)
+		.def_readonly("material1", &VCT::ExtractedEdge::material1);
+
+	auto edgeExtractionSettings = py::class_<VCT::EdgeExtractionSettings>(m, "EdgeExtractionSettings")
+		.def(py::init<>())
+		.def_readwrite("voxel_size", &VCT::EdgeExtractionSettings::voxelSize)
+		.def_readwrite("min_edge_angle", &VCT::EdgeExtractionSettings::minEdgeAngle)
+		.def_readwrite("normal_cluster_angle", &VCT::EdgeExtractionSettings::normalClusterAngle)
+		.def_readwrite("min_patch_points", &VCT::EdgeExtractionSettings::minPatchPoints)
+		.def_readwrite("max_plane_distance", &VCT::EdgeExtractionSettings::maxPlaneDistance)
+		.def_readwrite("min_edge_length", &VCT::EdgeExtractionSettings::minEdgeLength)
+		.def_readwrite("include_concave", &VCT::EdgeExtractionSettings::includeConcave)
+		.def_readwrite("num_threads", &VCT::EdgeExtractionSettings::numThreads);
 
 	auto sceneSettings = py::class_<VCT::SceneSettings>(m, "SceneSettings")
 		.def(py::init<>())
@@ -122,7 +173,27 @@ PYBIND11_MODULE(_C, m)
 		.def_readwrite("angle_threshold", &VCT::SceneSettings::angleThreshold)
 		.def_readwrite("distance_threshold", &VCT::SceneSettings::distanceThreshold)
 		.def_readwrite("block_size", &VCT::SceneSettings::blockSize)
-		.def_readwrite("num_coarse_paths_per_unique_route", &VCT::SceneSettings::numCoarsePathsPerUniqueRoute);
+		.def_readwrite("num_coarse_paths_per_unique_route", &VCT::SceneSettings::numCoarsePathsPerUniqueRoute)
+		.def_readwrite("use_directional_skip_distances", &VCT::SceneSettings::useDirectionalSkipDistances)
+		.def_readwrite("deterministic_emission", &VCT::SceneSettings::deterministicEmission)
+		.def_readwrite("beam_width", &VCT::SceneSettings::beamWidth)
+		.def_readwrite("ray_merge_limit", &VCT::SceneSettings::rayMergeLimit)
+		.def_readwrite("ray_merge_direction_resolution", &VCT::SceneSettings::rayMergeDirectionResolution)
+		.def_readwrite("max_time_delay", &VCT::SceneSettings::maxTimeDelay)
+		.def_readwrite("max_path_loss", &VCT::SceneSettings::maxPathLoss)
+		.def_readwrite("bidirectional_search", &VCT::SceneSettings::bidirectionalSearch)
+		.def_readwrite("label_visibility_samples", &VCT::SceneSettings::labelVisibilitySamples)
+		.def_readwrite("diffraction_receiver_culling", &VCT::SceneSettings::diffractionReceiverCulling)
+		.def_readwrite("edge_segment_merge_count", &VCT::SceneSettings::edgeSegmentMergeCount)
+		.def_readwrite("coarse_path_memory_limit_mb", &VCT::SceneSettings::coarsePathMemoryLimitMB)
+		.def_readwrite("path_spill_directory", &VCT::SceneSettings::pathSpillDirectory);
+
+	auto material = py::class_<VCT::Material>(m, "NativeMaterial")
+		.def(py::init<>())
+		.def_readwrite("a", &VCT::Material::a)
+		.def_readwrite("b", &VCT::Material::b)
+		.def_readwrite("c", &VCT::Material::c)
+		.def_readwrite("d", &VCT::Material::d);
 
 	auto object = py::class_<VCT::Object3D>(m, "NativeObject3D")
 		.def(py::init<const std::array<float, 3>&>());
@@ -130,6 +201,7 @@ PYBIND11_MODULE(_C, m)
 	auto cpInput = py::class_<VCT::InputData>(m, "InputData")
 		.def(py::init<>())
 		.def_readwrite("scene_settings", &VCT::InputData::sceneSettings)
+		.def_readwrite("materials", &VCT::InputData::materials)
 		.def_readwrite("num_interactions", &VCT::InputData::numInteractions)
 		.def_readwrite("num_diffractions", &VCT::InputData::numDiffractions);
 }
\ No newline at end of file
@@ -25,6 +25,21 @@ struct VCTParams
     uint32_t subIeVoxelAxisSizeFactor = 4;
     bool useLabelHashing = true;
     bool useConeReflections = true;
+    bool useDirectionalSkipDistances = false;
+    bool deterministicEmission = false;
+    uint32_t beamWidth = 0;
+    uint32_t rayMergeLimit = 0;
+    float rayMergeDirectionResolution = 0.05f;
+    float maxTimeDelay = 0.0f;
+    float frequency = 60e9f;
+    float maxPathLoss = 0.0f;
+    std::vector<VCT::Material> materials;
+    bool bidirectionalSearch = false;
+    uint32_t labelVisibilitySamples = 0;
+    bool diffractionReceiverCulling = false;
+    uint32_t edgeSegmentMergeCount = 1;
+    uint32_t coarsePathMemoryLimitMB = 0;
+    std::string pathSpillDirectory;
     uint32_t numOfCoarsePathsPerUniqueRoute = 100;
 
     VCT::RefineParams refineParams = { 2000, 1e-4f, 0.4f, 0.4f, 0.99999f, 0.002f };
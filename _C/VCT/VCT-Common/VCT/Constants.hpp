@@ -7,6 +7,12 @@ namespace VCT::Constants
     constexpr uint32_t InvalidPointIndex = ~0u;
     constexpr uint32_t MaximumNumberOfInteractions = 8;
     constexpr uint32_t UnitCircleDiscretizationCount = 100;
+    constexpr uint32_t WedgeAngleDiscretizationCount = 1024;
+    constexpr uint32_t MaximumDirectionalSkipDistance = 255;
+    constexpr uint32_t ReflectionLossBinCount = 32;
+    constexpr uint8_t VoxelOccupiedBit = 0x80;
+    constexpr uint8_t MaximumMarchDistance = 0x7F;
+    constexpr float InvalidVoxelCoordinate = -3.0f;
 
     constexpr float SeparationPlaneBias = 1e-2f;
     constexpr float LightSpeedInVacuum = 299792458.0f;
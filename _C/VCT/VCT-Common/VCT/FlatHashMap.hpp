@@ -0,0 +1,121 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace VCT
+{
+    // Open addressing hash map with linear probing. Entries are stored densely in insertion order and the slot table only holds
+    // their indices, so iteration is deterministic and rehashing only rebuilds the index table.
+    template <typename Key, typename Value, typename Hash = std::hash<Key>>
+    class FlatHashMap
+    {
+    public:
+        using Entry = std::pair<Key, Value>;
+
+        template <typename... Args>
+        std::pair<Value*, bool> TryEmplace(const Key& key, Args&&... args)
+        {
+            if ((m_Entries.size() + 1) * 2 > m_Slots.size())
+                Rehash(m_Slots.empty() ? MinimumSlotCount : m_Slots.size() * 2);
+
+            size_t hash = MixHash(Hash()(key));
+            uint32_t tag = GetTag(hash);
+            size_t slot = hash & m_Mask;
+            for (; m_Slots[slot].index != EmptySlot; slot = (slot + 1) & m_Mask)
+            {
+                const Slot& s = m_Slots[slot];
+                if (s.tag == tag && m_Entries[s.index].first == key)
+                    return { &m_Entries[s.index].second, false };
+            }
+
+            m_Slots[slot] = { static_cast<uint32_t>(m_Entries.size()), tag };
+            m_Entries.emplace_back(std::piecewise_construct, std::forward_as_tuple(key), std::forward_as_tuple(std::forward<Args>(args)...));
+            return { &m_Entries.back().second, true };
+        }
+
+        Value* Find(const Key& key) { return const_cast<Value*>(static_cast<const FlatHashMap*>(this)->Find(key)); }
+        const Value* Find(const Key& key) const
+        {
+            if (m_Slots.empty())
+                return nullptr;
+
+            size_t hash = MixHash(Hash()(key));
+            uint32_t tag = GetTag(hash);
+            for (size_t slot = hash & m_Mask; m_Slots[slot].index != EmptySlot; slot = (slot + 1) & m_Mask)
+            {
+                const Slot& s = m_Slots[slot];
+                if (s.tag == tag && m_Entries[s.index].first == key)
+                    return &m_Entries[s.index].second;
+            }
+            return nullptr;
+        }
+
+        void Reserve(size_t numEntries)
+        {
+            m_Entries.reserve(numEntries);
+            size_t numSlots = MinimumSlotCount;
+            while (numSlots < numEntries * 2)
+                numSlots *= 2;
+            if (numSlots > m_Slots.size())
+                Rehash(numSlots);
+        }
+
+        void Clear()
+        {
+            m_Slots.clear();
+            m_Entries.clear();
+            m_Mask = 0;
+        }
+
+        size_t Size() const { return m_Entries.size(); }
+        bool Empty() const { return m_Entries.empty(); }
+
+        typename std::vector<Entry>::iterator begin() { return m_Entries.begin(); }
+        typename std::vector<Entry>::iterator end() { return m_Entries.end(); }
+        typename std::vector<Entry>::const_iterator begin() const { return m_Entries.begin(); }
+        typename std::vector<Entry>::const_iterator end() const { return m_Entries.end(); }
+
+    private:
+        // The slot keeps the upper hash bits next to the entry index, so most mismatches are rejected without touching the entry.
+        struct Slot
+        {
+            uint32_t index;
+            uint32_t tag;
+        };
+
+        static constexpr uint32_t EmptySlot = ~0u;
+        static constexpr size_t MinimumSlotCount = 16;
+
+        static uint32_t GetTag(size_t hash) { return static_cast<uint32_t>(static_cast<uint64_t>(hash) >> 32); }
+
+        static size_t MixHash(size_t hash)
+        {
+            uint64_t h = static_cast<uint64_t>(hash);
+            h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ull;
+            h = (h ^ (h >> 27)) * 0x94D049BB133111EBull;
+            return static_cast<size_t>(h ^ (h >> 31));
+        }
+
+        void Rehash(size_t numSlots)
+        {
+            m_Slots.assign(numSlots, { EmptySlot, 0 });
+            m_Mask = numSlots - 1;
+            for (uint32_t index = 0; index < m_Entries.size(); ++index)
+            {
+                size_t hash = MixHash(Hash()(m_Entries[index].first));
+                size_t slot = hash & m_Mask;
+                while (m_Slots[slot].index != EmptySlot)
+                    slot = (slot + 1) & m_Mask;
+                m_Slots[slot] = { index, GetTag(hash) };
+            }
+        }
+
+    private:
+        std::vector<Slot> m_Slots;
+        std::vector<Entry> m_Entries;
+        size_t m_Mask = 0;
+    };
+}
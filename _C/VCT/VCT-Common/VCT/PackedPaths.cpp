@@ -0,0 +1,89 @@
+#include "PackedPaths.hpp"
+#include <cassert>
+#include <istream>
+#include <ostream>
+
+namespace VCT
+{
+    void PackedPaths::Add(const TraceData& traceData)
+    {
+        PackedPathHeader& header = m_Headers.emplace_back();
+        header.transmitterID = traceData.transmitterID;
+        header.receiverID = traceData.receiverID;
+        header.timeDelay = traceData.timeDelay;
+        header.numInteractions = static_cast<uint16_t>(traceData.numInteractions);
+        header.firstInteraction = static_cast<uint32_t>(m_Interactions.size());
+        m_Interactions.resize(m_Interactions.size() + traceData.numInteractions);
+        PackInteractions(traceData, header);
+    }
+
+    void PackedPaths::Add(const PackedPaths& paths, uint32_t index)
+    {
+        const PackedPathHeader& source = paths.m_Headers[index];
+        PackedPathHeader& header = m_Headers.emplace_back(source);
+        header.firstInteraction = static_cast<uint32_t>(m_Interactions.size());
+        m_Interactions.insert(m_Interactions.end(), paths.GetInteractions(index), paths.GetInteractions(index) + source.numInteractions);
+    }
+
+    // The records of the replaced path are reused, so the new path must have the same number of interactions.
+    void PackedPaths::Replace(uint32_t index, const TraceData& traceData)
+    {
+        assert(index < m_Headers.size() && m_Headers[index].numInteractions == traceData.numInteractions);
+        PackedPathHeader& header = m_Headers[index];
+        header.transmitterID = traceData.transmitterID;
+        header.receiverID = traceData.receiverID;
+        header.timeDelay = traceData.timeDelay;
+        PackInteractions(traceData, header);
+    }
+
+    void PackedPaths::Clear()
+    {
+        std::vector<PackedPathHeader>().swap(m_Headers);
+        std::vector<PackedInteraction>().swap(m_Interactions);
+    }
+
+    TraceData PackedPaths::Unpack(uint32_t index) const
+    {
+        TraceData traceData{};
+        UnpackPath(m_Headers[index], m_Interactions.data(), traceData);
+        return traceData;
+    }
+
+    void PackedPaths::Write(std::ostream& stream) const
+    {
+        stream.write(reinterpret_cast<const char*>(m_Headers.data()), sizeof(PackedPathHeader) * m_Headers.size());
+        stream.write(reinterpret_cast<const char*>(m_Interactions.data()), sizeof(PackedInteraction) * m_Interactions.size());
+    }
+
+    // A short or failed read clears the paths, so a partial block is never handed on.
+    bool PackedPaths::Read(std::istream& stream, uint32_t numPaths, uint32_t numInteractions)
+    {
+        m_Headers.resize(numPaths);
+        m_Interactions.resize(numInteractions);
+        stream.read(reinterpret_cast<char*>(m_Headers.data()), sizeof(PackedPathHeader) * m_Headers.size());
+        stream.read(reinterpret_cast<char*>(m_Interactions.data()), sizeof(PackedInteraction) * m_Interactions.size());
+        if (stream.fail())
+        {
+            Clear();
+            return false;
+        }
+        return true;
+    }
+
+    void PackedPaths::PackInteractions(const TraceData& traceData, PackedPathHeader& header)
+    {
+        header.types = 0;
+        for (uint32_t i = 0; i < traceData.numInteractions; ++i)
+        {
+            const Interaction& interaction = traceData.interactions[i];
+            PackedInteraction& packed = m_Interactions[header.firstInteraction + i];
+            packed.position = interaction.position;
+            packed.normal = interaction.normal;
+            packed.ieID = interaction.ieID;
+            packed.label = interaction.label;
+            packed.materialID = interaction.materialID;
+            packed.curvature = interaction.curvature;
+            header.types |= static_cast<uint16_t>((static_cast<uint32_t>(interaction.type) & 3u) << (2 * i));
+        }
+    }
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include "Types.hpp"
+#include <iosfwd>
+#include <vector>
+
+namespace VCT
+{
+    // Host container of packed paths. Headers and interaction records live in two arrays, a path only occupies the records it uses.
+    class PackedPaths
+    {
+    public:
+        void Add(const TraceData& traceData);
+        void Add(const PackedPaths& paths, uint32_t index);
+        void Replace(uint32_t index, const TraceData& traceData);
+        void Clear();
+
+        TraceData Unpack(uint32_t index) const;
+        void Write(std::ostream& stream) const;
+        bool Read(std::istream& stream, uint32_t numPaths, uint32_t numInteractions);
+
+        const PackedPathHeader& GetHeader(uint32_t index) const { return m_Headers[index]; }
+        const PackedInteraction* GetInteractions(uint32_t index) const { return m_Interactions.data() + m_Headers[index].firstInteraction; }
+        const std::vector<PackedPathHeader>& GetHeaders() const { return m_Headers; }
+        const std::vector<PackedInteraction>& GetInteractions() const { return m_Interactions; }
+
+        uint32_t Size() const { return static_cast<uint32_t>(m_Headers.size()); }
+        bool Empty() const { return m_Headers.empty(); }
+        size_t GetNumBytes() const { return sizeof(PackedPathHeader) * m_Headers.size() + sizeof(PackedInteraction) * m_Interactions.size(); }
+        static size_t GetNumBytes(uint32_t numInteractions) { return sizeof(PackedPathHeader) + sizeof(PackedInteraction) * numInteractions; }
+
+    private:
+        void PackInteractions(const TraceData& traceData, PackedPathHeader& header);
+
+    private:
+        std::vector<PackedPathHeader> m_Headers;
+        std::vector<PackedInteraction> m_Interactions;
+    };
+}
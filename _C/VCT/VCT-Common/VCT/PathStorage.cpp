@@ -2,98 +2,282 @@
 #include "Common.hpp"
 #include <algorithm>
 #include <array>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <future>
+#include <limits>
+#include <numeric>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <unordered_map>
 
 namespace VCT
 {
-    namespace
+    constexpr uint32_t RemovedPathIndex = std::numeric_limits<uint32_t>::max();
+    constexpr uint32_t MaxSpillFileAttempts = 16;
+
+    // Spill file names combine a random per-process token with a per-process counter. The file is created exclusively, so a name that
+    // is taken anyway, by another process or a stale file, is skipped instead of truncated.
+    static bool CreateSpillFile(const std::filesystem::path& directory, std::filesystem::path& path)
     {
-        size_t TxRxHash(const TraceData& traceData)
+        static const uint64_t processToken = (static_cast<uint64_t>(std::random_device()()) << 32) | std::random_device()();
+        static std::atomic<uint32_t> nextSpillFile{ 0 };
+        for (uint32_t attempt = 0; attempt < MaxSpillFileAttempts; ++attempt)
         {
-            return CalculateHash(traceData.transmitterID, traceData.receiverID);
+            path = directory / ("vct-paths-" + std::to_string(processToken) + "-" + std::to_string(nextSpillFile++) + ".bin");
+            if (std::FILE* file = std::fopen(path.string().c_str(), "wbx"))
+            {
+                std::fclose(file);
+                return true;
+            }
         }
+        return false;
+    }
 
-        size_t GetPathHash(const TraceData& traceData)
+    bool PathStorage::RouteKey::operator==(const RouteKey& other) const
+    {
+        return std::memcmp(this, &other, sizeof(RouteKey)) == 0;
+    }
+
+    size_t PathStorage::RouteKeyHash::operator()(const RouteKey& key) const
+    {
+        size_t hash = CalculateHash(key.transmitterID, key.receiverID, key.numInteractions, key.types);
+        for (uint32_t i = 0; i < key.numInteractions; ++i)
+            CombineHash(hash, key.labels[i]);
+        return hash;
+    }
+
+    PathStorage::SpillFile::~SpillFile()
+    {
+        if (stream.is_open())
         {
-            size_t hash = CalculateHash(traceData.transmitterID, traceData.receiverID);
-            for (uint32_t i = 0; i < traceData.numInteractions; ++i)
-                CombineHash(hash, traceData.interactions[i].label, static_cast<uint32_t>(traceData.interactions[i].type));
-            return hash;
+            stream.close();
+            std::error_code error;
+            std::filesystem::remove(path, error);
         }
     }
 
-    PathStorage::PathStorage(uint32_t pathsPerHash)
+    PathStorage::PathStorage(uint32_t pathsPerHash, size_t memoryLimit, const std::filesystem::path& spillDirectory)
         : m_PathsPerHash(pathsPerHash)
+        , m_MemoryLimit(memoryLimit)
+        , m_SpillDirectory(spillDirectory)
+        , m_Shards(NumShards)
     {
+        if (m_MemoryLimit > 0)
+            m_SpillFile = std::make_unique<SpillFile>();
     }
 
     void PathStorage::AddPaths(const std::vector<TraceData>& traceDatas, bool useHash)
     {
-        for (auto& traceData : traceDatas)
-            AddPath(traceData, useHash);
+        AddPaths(traceDatas.data(), static_cast<uint32_t>(traceDatas.size()), useHash);
     }
 
-    void PathStorage::AddPaths(const TraceData* traceDatas, uint32_t numPaths, bool useHash)
+    void PathStorage::AddPaths(const TraceData* traceDatas, uint32_t numPaths, bool useHash, uint32_t numThreads)
     {
+        // Stage the batch per shard on the calling thread, then merge each stage under a single lock of its shard.
+        // Workers take whole shards and a stage keeps the batch order, so every link sees its paths in the same order for any thread count.
+        std::vector<uint8_t> shardIndices(numPaths);
+        std::array<uint32_t, NumShards + 1> shardOffsets{};
+        for (uint32_t i = 0; i < numPaths; ++i)
+        {
+            shardIndices[i] = static_cast<uint8_t>(GetShardIndex(traceDatas[i].transmitterID, traceDatas[i].receiverID));
+            ++shardOffsets[shardIndices[i] + 1];
+        }
+        for (uint32_t shardIndex = 0; shardIndex < NumShards; ++shardIndex)
+            shardOffsets[shardIndex + 1] += shardOffsets[shardIndex];
+
+        std::vector<uint32_t> stagedPaths(numPaths);
+        std::array<uint32_t, NumShards + 1> stageEnds = shardOffsets;
         for (uint32_t i = 0; i < numPaths; ++i)
-            AddPath(traceDatas[i], useHash);
+            stagedPaths[stageEnds[shardIndices[i]]++] = i;
+
+        std::atomic<uint32_t> nextShard{ 0 };
+        auto mergeStages = [&]()
+        {
+            for (uint32_t shardIndex = nextShard++; shardIndex < NumShards; shardIndex = nextShard++)
+            {
+                if (shardOffsets[shardIndex] == shardOffsets[shardIndex + 1])
+                    continue;
+
+                Shard& shard = m_Shards[shardIndex];
+                std::lock_guard<std::mutex> lock(shard.mutex);
+                for (uint32_t i = shardOffsets[shardIndex]; i < shardOffsets[shardIndex + 1]; ++i)
+                    InsertPath(shard, traceDatas[stagedPaths[i]], useHash);
+            }
+        };
+
+        std::vector<std::future<void>> workers;
+        for (uint32_t i = 1; i < glm::min(numThreads, NumShards); ++i)
+            workers.push_back(std::async(std::launch::async, mergeStages));
+        mergeStages();
+        for (auto& worker : workers)
+            worker.get();
+
+        if (m_SpillFile && m_SpillFile->residentBytes > m_MemoryLimit)
+            Spill();
     }
 
     void PathStorage::AddPath(const TraceData& traceData, bool useHash)
     {
-        std::vector<TraceData>& txRxPaths = m_PathMap[TxRxHash(traceData)];
+        Shard& shard = m_Shards[GetShardIndex(traceData.transmitterID, traceData.receiverID)];
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            InsertPath(shard, traceData, useHash);
+        }
+
+        if (m_SpillFile && m_SpillFile->residentBytes > m_MemoryLimit)
+            Spill();
+    }
+
+    // Drops all paths and routes. A spill file is closed and removed, the next spill starts a new one.
+    void PathStorage::Clear()
+    {
+        for (Shard& shard : m_Shards)
+        {
+            shard.routeMap.Clear();
+            shard.pathMap.Clear();
+        }
+        if (m_SpillFile)
+            m_SpillFile = std::make_unique<SpillFile>();
+    }
+
+    void PathStorage::InsertPath(Shard& shard, const TraceData& traceData, bool useHash)
+    {
+        LinkPaths& link = *shard.pathMap.TryEmplace(GetLinkKey(traceData.transmitterID, traceData.receiverID)).first;
         if (useHash)
         {
-             PathReference& pathRef = m_PathHashReferenceMap[GetPathHash(traceData)];
-             if (pathRef.references.size() == 0)
-                 pathRef.references.reserve(m_PathsPerHash);
-
-             if (pathRef.references.size() == m_PathsPerHash)
-             {
-                 if (traceData.timeDelay > pathRef.maxTimeDelay)
-                     return;
-             
-                 txRxPaths.at(pathRef.references[pathRef.longestPathIndex]) = traceData;
-                 pathRef.maxTimeDelay = traceData.timeDelay;
-                 for (uint32_t i = 0; i < pathRef.references.size(); ++i)
-                 {
-                     if (txRxPaths[pathRef.references[i]].timeDelay > pathRef.maxTimeDelay)
-                     {
-                         pathRef.longestPathIndex = i;
-                         pathRef.maxTimeDelay = txRxPaths[pathRef.references[i]].timeDelay;
-                     }
-                 }
-                 return;
-             }
-             else
-             {
-                 if (traceData.timeDelay > pathRef.maxTimeDelay)
-                 {
-                     pathRef.maxTimeDelay = traceData.timeDelay;
-                     pathRef.longestPathIndex = static_cast<uint32_t>(pathRef.references.size());
-                 }
-                 pathRef.references.push_back(static_cast<uint32_t>(txRxPaths.size()));
-             }
-        }
-        txRxPaths.push_back(traceData);
+            RouteKey key{};
+            key.transmitterID = traceData.transmitterID;
+            key.receiverID = traceData.receiverID;
+            key.numInteractions = traceData.numInteractions;
+            for (uint32_t i = 0; i < traceData.numInteractions; ++i)
+            {
+                key.labels[i] = traceData.interactions[i].label;
+                key.types |= static_cast<uint32_t>(traceData.interactions[i].type) << (4 * i);
+            }
+
+            RoutePaths& route = *shard.routeMap.TryEmplace(key).first;
+            std::vector<std::pair<float, uint32_t>>& heap = route.heap;
+            if (heap.size() == m_PathsPerHash)
+            {
+                if (m_PathsPerHash == 0 || traceData.timeDelay > route.maxTimeDelay)
+                    return;
+
+                std::pop_heap(heap.begin(), heap.end());
+                uint32_t& pathIndex = heap.back().second;
+                if (pathIndex >= link.numSpilled)
+                    link.paths.Replace(pathIndex - link.numSpilled, traceData);
+                else
+                {
+                    link.evicted[pathIndex] = true;
+                    pathIndex = link.numSpilled + link.paths.Size();
+                    AppendPath(link, traceData);
+                }
+                heap.back().first = traceData.timeDelay;
+                std::push_heap(heap.begin(), heap.end());
+                route.maxTimeDelay = heap.front().first;
+                return;
+            }
+
+            if (heap.empty())
+                heap.reserve(m_PathsPerHash);
+            heap.emplace_back(traceData.timeDelay, link.numSpilled + link.paths.Size());
+            std::push_heap(heap.begin(), heap.end());
+            route.maxTimeDelay = heap.front().first;
+        }
+        AppendPath(link, traceData);
+    }
+
+    void PathStorage::AppendPath(LinkPaths& link, const TraceData& traceData)
+    {
+        link.paths.Add(traceData);
+        if (m_SpillFile)
+            m_SpillFile->residentBytes += PackedPaths::GetNumBytes(traceData.numInteractions);
+    }
+
+    void PathStorage::Spill()
+    {
+        // Another thread already spilling will bring the resident size down, so there is no need to wait for it.
+        std::unique_lock<std::mutex> spillLock(m_SpillFile->mutex, std::try_to_lock);
+        if (!spillLock.owns_lock())
+            return;
+
+        SpillFile& spillFile = *m_SpillFile;
+        if (spillFile.failed)
+            return;
+
+        if (!spillFile.stream.is_open())
+        {
+            std::filesystem::path directory = m_SpillDirectory.empty() ? std::filesystem::temp_directory_path() : m_SpillDirectory;
+            bool created = CreateSpillFile(directory, spillFile.path);
+            if (created)
+                spillFile.stream.open(spillFile.path, std::ios::binary | std::ios::in | std::ios::out);
+            if (!spillFile.stream.is_open())
+            {
+                LOG("Failed to open path spill file %s, keeping paths in memory.", spillFile.path.string().c_str());
+                std::error_code error;
+                if (created)
+                    std::filesystem::remove(spillFile.path, error);
+                spillFile.failed = true;
+                return;
+            }
+        }
+
+        // Spill down to half the limit so a storage hovering around the limit does not spill a handful of paths per batch.
+        size_t targetBytes = m_MemoryLimit / 2;
+        for (Shard& shard : m_Shards)
+        {
+            if (spillFile.residentBytes <= targetBytes)
+                break;
+
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            for (auto& [linkKey, link] : shard.pathMap)
+            {
+                if (link.paths.Empty())
+                    continue;
+
+                // A block is only recorded once it is flushed, otherwise the paths stay resident and spilling stops.
+                size_t numBytes = link.paths.GetNumBytes();
+                spillFile.stream.seekp(spillFile.size);
+                link.paths.Write(spillFile.stream);
+                spillFile.stream.flush();
+                if (!spillFile.stream)
+                {
+                    LOG("Failed to write path spill file %s, keeping paths in memory.", spillFile.path.string().c_str());
+                    spillFile.stream.clear();
+                    spillFile.failed = true;
+                    return;
+                }
+
+                link.spilledBlocks.push_back({ spillFile.size, link.paths.Size(), static_cast<uint32_t>(link.paths.GetInteractions().size()) });
+                link.numSpilled += link.paths.Size();
+                link.evicted.resize(link.numSpilled, false);
+                link.paths.Clear();
+                spillFile.size += numBytes;
+                spillFile.residentBytes -= numBytes;
+            }
+        }
     }
 
     struct FresnelZone
     {
         FresnelZone() : point(glm::vec3(0.0f)), radiusSq(0.0f), iaType(VCT::InteractionType::Reflection), dstDir(0.0f), srcDir(0.0f) {}
-        FresnelZone(const VCT::Interaction& ia, const glm::vec3& src, const glm::vec3& dst, float waveLength)
+        FresnelZone(const VCT::PackedInteraction& ia, VCT::InteractionType type, const glm::vec3& src, const glm::vec3& dst, float waveLength)
             : point(ia.position)
             , radiusSq([&]() -> float {float d1 = glm::length(src - ia.position); float d2 = glm::length(dst - ia.position); return (d1 * d2) / (d1 + d2) * waveLength; }())
-            , iaType(ia.type)
+            , iaType(type)
             , srcDir(glm::normalize(ia.position - src))
             , dstDir(glm::normalize(dst - ia.position))
         {
 
         }
 
-        bool InZone(const VCT::Interaction& ia, const glm::vec3& src, const glm::vec3& dst) const
+        bool InZone(const FresnelZone& other) const
         {
-            glm::vec3 diff = ia.position - point;
-            return iaType == ia.type  && glm::dot(glm::normalize(ia.position - src), srcDir) > 0.99f && glm::dot(glm::normalize(dst - ia.position), dstDir) > 0.99f && glm::dot(diff, diff) <= radiusSq;
+            glm::vec3 diff = other.point - point;
+            return iaType == other.iaType && glm::dot(other.srcDir, srcDir) > 0.99f && glm::dot(other.dstDir, dstDir) > 0.99f && glm::dot(diff, diff) <= radiusSq;
         }
 
         glm::vec3 point;
@@ -105,83 +289,275 @@ namespace VCT
 
     struct PathFresnelZones
     {
-        PathFresnelZones(const TraceData& traceData, const Transmitter& transmitter, const Receiver& receiver, float waveLength)
-            : numZones(traceData.numInteractions)
+        PathFresnelZones(const PackedPathHeader& header, const PackedInteraction* interactions, const Transmitter& transmitter, const Receiver& receiver, float waveLength)
+            : numZones(header.numInteractions)
         {
-            if (numZones > 1)
+            for (int32_t i = 0; i < numZones; ++i)
             {
-                zones[0] = FresnelZone(traceData.interactions[0], transmitter.position, traceData.interactions[1].position, waveLength);
-
-                for (int32_t i = 1; i < numZones - 1; ++i)
-                    zones[i] = FresnelZone(traceData.interactions[i], traceData.interactions[i - 1].position, traceData.interactions[i + 1].position, waveLength);
-
-                zones[numZones - 1] = FresnelZone(traceData.interactions[numZones - 1], traceData.interactions[numZones - 2].position, receiver.position, waveLength);
+                const glm::vec3& src = i > 0 ? interactions[i - 1].position : transmitter.position;
+                const glm::vec3& dst = i < numZones - 1 ? interactions[i + 1].position : receiver.position;
+                zones[i] = FresnelZone(interactions[i], GetPackedInteractionType(header, i), src, dst, waveLength);
             }
-            else
-                zones[0] = FresnelZone(traceData.interactions[0], transmitter.position, receiver.position, waveLength);
         }
 
-        bool IsSharedZone(const TraceData& traceData, const glm::vec3& tx, const glm::vec3& rx) const
+        bool IsSharedZone(const PathFresnelZones& other) const
         { 
-            if (traceData.numInteractions != numZones)
+            if (other.numZones != numZones)
                 return false;
             
             for (int32_t i = 0; i < numZones; ++i)
             {
-                glm::vec3 src = (i == 0) ? tx : traceData.interactions[i - 1].position;
-                glm::vec3 dst = (i == numZones - 1) ? rx : traceData.interactions[i + 1].position;
-                if (!zones[i].InZone(traceData.interactions[i], src, dst))
+                if (!zones[i].InZone(other.zones[i]))
                     return false;
             }
             return true;
         }
+
+        size_t GetBucketHash(const glm::ivec3& cell) const
+        {
+            size_t hash = CalculateHash(numZones, cell.x, cell.y, cell.z);
+            for (int32_t i = 0; i < numZones; ++i)
+                CombineHash(hash, static_cast<uint32_t>(zones[i].iaType));
+            return hash;
+        }
     
         std::array<FresnelZone, VCT::Constants::MaximumNumberOfInteractions> zones;
         int32_t numZones;
     };
 
-    bool IsInExistingPathZone(const TraceData& traceData, const Transmitter& transmitter, const Receiver& receiver, float waveLength, std::vector<VCT::PathFresnelZones>& zones)
+    // A path can only share the zones of an earlier path with the same interaction types whose first zone contains its first interaction.
+    // Zones are bucketed by those types and by the first interaction on a grid with cells as large as the largest first zone radius,
+    // so the 27 surrounding cells hold every zone the full scan would find.
+    // Returns the new index of every path, or RemovedPathIndex for the removed ones.
+    std::vector<uint32_t> RemoveDuplicatePaths(PackedPaths& paths, const Transmitter& transmitter, const Receiver& receiver, float waveLength)
     {
-        bool result = false;
-        for (auto& zone : zones)
+        std::vector<uint32_t> order(paths.Size());
+        std::iota(order.begin(), order.end(), 0u);
+        std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return paths.GetHeader(a).timeDelay < paths.GetHeader(b).timeDelay; });
+
+        std::vector<PathFresnelZones> pathFresnelZones;
+        pathFresnelZones.reserve(paths.Size());
+        float maxRadiusSq = 0.0f;
+        for (uint32_t pathIndex : order)
         {
-            if (zone.IsSharedZone(traceData, transmitter.position, receiver.position))
+            if (paths.GetHeader(pathIndex).numInteractions == 0)
+                continue;
+            pathFresnelZones.emplace_back(paths.GetHeader(pathIndex), paths.GetInteractions(pathIndex), transmitter, receiver, waveLength);
+            maxRadiusSq = glm::max(maxRadiusSq, pathFresnelZones.back().zones[0].radiusSq);
+        }
+        float invCellSize = 1.0f / glm::max(std::sqrt(maxRadiusSq), 1e-3f);
+
+        std::unordered_map<size_t, std::vector<uint32_t>> buckets;
+        buckets.reserve(pathFresnelZones.size());
+
+        PackedPaths newPaths;
+        std::vector<uint32_t> newIndices(paths.Size(), RemovedPathIndex);
+        uint32_t zoneIndex = 0;
+        for (uint32_t pathIndex : order)
+        {
+            if (paths.GetHeader(pathIndex).numInteractions == 0)
             {
-                result = true;
-                break;
+                newIndices[pathIndex] = newPaths.Size();
+                newPaths.Add(paths, pathIndex);
+                continue;
             }
+
+            const PathFresnelZones& pathZones = pathFresnelZones[zoneIndex];
+            glm::ivec3 cell = glm::ivec3(glm::floor(pathZones.zones[0].point * invCellSize));
+            bool shared = false;
+            for (int32_t z = -1; z <= 1 && !shared; ++z)
+                for (int32_t y = -1; y <= 1 && !shared; ++y)
+                    for (int32_t x = -1; x <= 1 && !shared; ++x)
+                    {
+                        auto it = buckets.find(pathZones.GetBucketHash(cell + glm::ivec3(x, y, z)));
+                        if (it == buckets.end())
+                            continue;
+                        for (uint32_t otherIndex : it->second)
+                        {
+                            if (pathFresnelZones[otherIndex].IsSharedZone(pathZones))
+                            {
+                                shared = true;
+                                break;
+                            }
+                        }
+                    }
+
+            if (!shared)
+            {
+                newIndices[pathIndex] = newPaths.Size();
+                newPaths.Add(paths, pathIndex);
+            }
+            buckets[pathZones.GetBucketHash(cell)].push_back(zoneIndex++);
         }
-        zones.emplace_back(traceData, transmitter, receiver, waveLength);
-        return result;
+        paths = std::move(newPaths);
+        return newIndices;
     }
 
     void PathStorage::TryRemoveDuplicates(uint32_t txID, uint32_t rxID, const Transmitter& transmitter, const Receiver& receiver, float waveLength)
     {
-        size_t txRxHash = CalculateHash(txID, rxID);
-        auto it = m_PathMap.find(txRxHash);
-        if (it != m_PathMap.end())
+        Shard& shard = m_Shards[GetShardIndex(txID, rxID)];
+        uint64_t linkKey = GetLinkKey(txID, rxID);
+        if (LinkPaths* link = shard.pathMap.Find(linkKey))
+        {
+            std::unordered_map<uint64_t, std::vector<uint32_t>> newIndices;
+            newIndices.emplace(linkKey, RemoveDuplicatePaths(link->paths, transmitter, receiver, waveLength));
+            RemapRoutes(shard, newIndices);
+        }
+    }
+
+    void PathStorage::TryRemoveDuplicates(const std::vector<Transmitter>& transmitters, const std::vector<Receiver>& receivers, float waveLength)
+    {
+        // Workers take whole shards, so the route heaps of a shard are remapped once after all of its links are deduplicated.
+        std::atomic<size_t> nextShard{ 0 };
+        std::vector<std::future<void>> workers;
+        for (uint32_t i = 0; i < glm::max(std::thread::hardware_concurrency(), 1u); ++i)
         {
-            std::vector<TraceData>& paths = it->second;
-            std::vector<PathFresnelZones> pathFresnelZones;
-            pathFresnelZones.reserve(paths.size());
+            workers.push_back(std::async(std::launch::async, [&]()
+            {
+                for (size_t shardIndex = nextShard++; shardIndex < m_Shards.size(); shardIndex = nextShard++)
+                {
+                    Shard& shard = m_Shards[shardIndex];
+                    std::unordered_map<uint64_t, std::vector<uint32_t>> newIndices;
+                    for (auto& [linkKey, link] : shard.pathMap)
+                    {
+                        if (!link.paths.Empty())
+                        {
+                            const Transmitter& transmitter = transmitters.at(static_cast<uint32_t>(linkKey >> 32));
+                            const Receiver& receiver = receivers.at(static_cast<uint32_t>(linkKey));
+                            newIndices.emplace(linkKey, RemoveDuplicatePaths(link.paths, transmitter, receiver, waveLength));
+                        }
+                    }
+                    RemapRoutes(shard, newIndices);
+                }
+            }));
+        }
+        for (auto& worker : workers)
+            worker.get();
+    }
 
-            std::vector<TraceData> newPaths;
-            newPaths.reserve(paths.size());
+    // Route heaps index the resident paths of their link, so they follow the paths that duplicate removal kept and drop the removed ones.
+    void PathStorage::RemapRoutes(Shard& shard, const std::unordered_map<uint64_t, std::vector<uint32_t>>& newIndices)
+    {
+        if (newIndices.empty())
+            return;
 
-            std::sort(paths.begin(), paths.end(), [](const TraceData& a, const TraceData& b) { return a.timeDelay < b.timeDelay; });
+        for (auto& [key, route] : shard.routeMap)
+        {
+            uint64_t linkKey = GetLinkKey(key.transmitterID, key.receiverID);
+            auto it = newIndices.find(linkKey);
+            if (it == newIndices.end())
+                continue;
 
-            for (const TraceData& path : paths)
+            uint32_t numSpilled = shard.pathMap.Find(linkKey)->numSpilled;
+            std::vector<std::pair<float, uint32_t>>& heap = route.heap;
+            size_t numKept = 0;
+            for (const auto& [timeDelay, pathIndex] : heap)
             {
-                if (path.numInteractions == 0 || !IsInExistingPathZone(path, transmitter, receiver, waveLength, pathFresnelZones))
-                    newPaths.push_back(path);
+                uint32_t newIndex = pathIndex < numSpilled ? pathIndex : it->second[pathIndex - numSpilled];
+                if (newIndex == RemovedPathIndex)
+                    continue;
+                heap[numKept++] = { timeDelay, pathIndex < numSpilled ? pathIndex : numSpilled + newIndex };
             }
-            it->second = std::move(newPaths);
+            heap.resize(numKept);
+            std::make_heap(heap.begin(), heap.end());
+            route.maxTimeDelay = heap.empty() ? 0.0f : heap.front().first;
         }
     }
 
-    const std::vector<TraceData>* PathStorage::GetPaths(uint32_t txID, uint32_t rxID) const
+    const PackedPaths* PathStorage::GetPaths(uint32_t txID, uint32_t rxID) const
     {
-        auto it = m_PathMap.find(CalculateHash(txID, rxID));
-        return it != m_PathMap.end() ? &it->second : nullptr;
+        const LinkPaths* link = m_Shards[GetShardIndex(txID, rxID)].pathMap.Find(GetLinkKey(txID, rxID));
+        return link ? &link->paths : nullptr;
+    }
+
+    uint32_t PathStorage::GetNumPaths(uint32_t txID, uint32_t rxID) const
+    {
+        const LinkPaths* link = m_Shards[GetShardIndex(txID, rxID)].pathMap.Find(GetLinkKey(txID, rxID));
+        if (!link)
+            return 0;
+        return link->numSpilled - static_cast<uint32_t>(std::count(link->evicted.begin(), link->evicted.end(), true)) + link->paths.Size();
+    }
+
+    bool PathStorage::ReadPaths(uint32_t txID, uint32_t rxID, uint32_t blockSize, const std::function<void(const PackedPaths&)>& onBlock) const
+    {
+        const LinkPaths* link = m_Shards[GetShardIndex(txID, rxID)].pathMap.Find(GetLinkKey(txID, rxID));
+        if (!link)
+            return true;
+
+        blockSize = glm::max(blockSize, 1u);
+        if (link->numSpilled == 0 && link->paths.Size() <= blockSize)
+        {
+            if (!link->paths.Empty())
+                onBlock(link->paths);
+            return true;
+        }
+
+        PackedPaths block;
+        bool result = ReadLinkPaths(*link, blockSize, block, onBlock);
+        if (!block.Empty())
+            onBlock(block);
+        return result;
+    }
+
+    bool PathStorage::ReadAllPaths(uint32_t blockSize, const std::function<void(const PackedPaths&)>& onBlock) const
+    {
+        blockSize = glm::max(blockSize, 1u);
+        PackedPaths block;
+        bool result = true;
+        for (const Shard& shard : m_Shards)
+        {
+            for (const auto& [linkKey, link] : shard.pathMap)
+                result &= ReadLinkPaths(link, blockSize, block, onBlock);
+        }
+        if (!block.Empty())
+            onBlock(block);
+        return result;
+    }
+
+    // Appends the paths of a link to the block and hands the block over whenever it is full.
+    bool PathStorage::ReadLinkPaths(const LinkPaths& link, uint32_t blockSize, PackedPaths& block, const std::function<void(const PackedPaths&)>& onBlock) const
+    {
+        auto addPath = [&](const PackedPaths& paths, uint32_t index)
+        {
+            block.Add(paths, index);
+            if (block.Size() == blockSize)
+            {
+                onBlock(block);
+                block.Clear();
+            }
+        };
+
+        // Spilled blocks of a link were appended in file order, so they are read back front to back.
+        PackedPaths spilledPaths;
+        uint32_t pathIndex = 0;
+        bool result = true;
+        for (const auto& spilledBlock : link.spilledBlocks)
+        {
+            bool read;
+            {
+                std::lock_guard<std::mutex> lock(m_SpillFile->mutex);
+                m_SpillFile->stream.clear();
+                m_SpillFile->stream.seekg(spilledBlock.offset);
+                read = spilledPaths.Read(m_SpillFile->stream, spilledBlock.numPaths, spilledBlock.numInteractions);
+                m_SpillFile->stream.clear();
+            }
+            if (!read)
+            {
+                LOG("Failed to read %u spilled paths at offset %llu of %s.", spilledBlock.numPaths, static_cast<unsigned long long>(spilledBlock.offset),
+                    m_SpillFile->path.string().c_str());
+                pathIndex += spilledBlock.numPaths;
+                result = false;
+                continue;
+            }
+            for (uint32_t i = 0; i < spilledPaths.Size(); ++i)
+            {
+                if (!link.evicted[pathIndex++])
+                    addPath(spilledPaths, i);
+            }
+        }
+
+        for (uint32_t i = 0; i < link.paths.Size(); ++i)
+            addPath(link.paths, i);
+        return result;
     }
 }
\ No newline at end of file
@@ -1,33 +1,118 @@
 #pragma once
 #include "Types.hpp"
-#include <unordered_set>
+#include "FlatHashMap.hpp"
+#include "PackedPaths.hpp"
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <unordered_map>
 
 namespace VCT
 {
+    // Paths are sharded by transmitter/receiver link, each shard guarded by its own lock, so AddPaths may be called from several
+    // threads at once. Reads (GetPaths, ReadPaths, TryRemoveDuplicates) are not synchronized with AddPaths.
+    // With a memory limit, resident path records beyond that limit are appended to a spill file in the spill directory. GetPaths and
+    // TryRemoveDuplicates only see resident paths, ReadPaths and ReadAllPaths stream spilled and resident paths in blocks. They skip
+    // spilled blocks that cannot be read back and return false in that case.
     class PathStorage
     {
     public:
-        PathStorage(uint32_t pathsPerHash = 10);
+        PathStorage(uint32_t pathsPerHash = 10, size_t memoryLimit = 0, const std::filesystem::path& spillDirectory = {});
 
         void AddPaths(const std::vector<TraceData>& traceDatas, bool useHash);
-        void AddPaths(const TraceData* traceDatas, uint32_t numPaths, bool useHash);
+        void AddPaths(const TraceData* traceDatas, uint32_t numPaths, bool useHash, uint32_t numThreads = 1);
         void AddPath(const TraceData& traceData, bool useHash);
+        void Clear();
         void TryRemoveDuplicates(uint32_t txID, uint32_t rxID, const Transmitter& transmitter, const Receiver& receiver, float waveLength);
+        void TryRemoveDuplicates(const std::vector<Transmitter>& transmitters, const std::vector<Receiver>& receivers, float waveLength);
 
-        const std::vector<TraceData>* GetPaths(uint32_t txID, uint32_t rxID) const;
+        // The returned paths live in the link map, so the pointer is invalidated by the next AddPaths or AddPath call.
+        const PackedPaths* GetPaths(uint32_t txID, uint32_t rxID) const;
+        uint32_t GetNumPaths(uint32_t txID, uint32_t rxID) const;
+        bool ReadPaths(uint32_t txID, uint32_t rxID, uint32_t blockSize, const std::function<void(const PackedPaths&)>& onBlock) const;
+        bool ReadAllPaths(uint32_t blockSize, const std::function<void(const PackedPaths&)>& onBlock) const;
+        uint64_t GetNumSpilledBytes() const { return m_SpillFile ? m_SpillFile->size : 0; }
 
     private:
-        struct PathReference
+        // Exact route signature. Interaction types are packed into 4 bits each, labels beyond numInteractions stay zero.
+        struct RouteKey
+        {
+            uint32_t transmitterID;
+            uint32_t receiverID;
+            uint32_t numInteractions;
+            uint32_t types;
+            std::array<uint32_t, Constants::MaximumNumberOfInteractions> labels;
+
+            bool operator==(const RouteKey& other) const;
+        };
+
+        struct RouteKeyHash
+        {
+            size_t operator()(const RouteKey& key) const;
+        };
+
+        // Max-heap on time delay of the path indices stored for a route, so the longest path is evicted first.
+        struct RoutePaths
         {
-            uint32_t longestPathIndex = 0;
             float maxTimeDelay = 0.0f;
-            std::vector<uint32_t> references;
+            std::vector<std::pair<float, uint32_t>> heap;
+        };
+
+        // Path indices of a link count the spilled paths first, so route heaps stay valid when the resident paths are spilled.
+        // A spilled path that is evicted from its route is only flagged, the replacement is appended to the resident paths.
+        struct LinkPaths
+        {
+            struct SpilledBlock
+            {
+                uint64_t offset;
+                uint32_t numPaths;
+                uint32_t numInteractions;
+            };
+
+            PackedPaths paths;
+            std::vector<SpilledBlock> spilledBlocks;
+            std::vector<bool> evicted;
+            uint32_t numSpilled = 0;
         };
 
+        struct alignas(64) Shard
+        {
+            std::mutex mutex;
+            FlatHashMap<RouteKey, RoutePaths, RouteKeyHash> routeMap;
+            FlatHashMap<uint64_t, LinkPaths> pathMap;
+        };
+
+        struct SpillFile
+        {
+            ~SpillFile();
+
+            std::mutex mutex;
+            std::filesystem::path path;
+            std::fstream stream;
+            uint64_t size = 0;
+            bool failed = false;
+            std::atomic<size_t> residentBytes{ 0 };
+        };
+
+        static constexpr uint32_t NumShards = 64;
+
+        static uint64_t GetLinkKey(uint32_t txID, uint32_t rxID) { return (static_cast<uint64_t>(txID) << 32) | rxID; }
+        static uint32_t GetShardIndex(uint32_t txID, uint32_t rxID) { return (txID * 0x9E3779B1u + rxID) % NumShards; }
+
+        void InsertPath(Shard& shard, const TraceData& traceData, bool useHash);
+        void AppendPath(LinkPaths& link, const TraceData& traceData);
+        void RemapRoutes(Shard& shard, const std::unordered_map<uint64_t, std::vector<uint32_t>>& newIndices);
+        void Spill();
+        bool ReadLinkPaths(const LinkPaths& link, uint32_t blockSize, PackedPaths& block, const std::function<void(const PackedPaths&)>& onBlock) const;
+
     private:
         uint32_t m_PathsPerHash;
-        std::unordered_map<size_t, PathReference> m_PathHashReferenceMap;
-        std::unordered_map<size_t, std::vector<TraceData>> m_PathMap;
+        size_t m_MemoryLimit;
+        std::filesystem::path m_SpillDirectory;
+        std::vector<Shard> m_Shards;
+        std::unique_ptr<SpillFile> m_SpillFile;
     };
 }
\ No newline at end of file
@@ -95,4 +95,52 @@ namespace VCT
         std::array<Interaction, Constants::MaximumNumberOfInteractions> interactions;
 #endif
     };
+
+    // Variable length path layout used on the host and as refinement input. A path is a header followed by exactly numInteractions
+    // records in a shared interaction array. Interaction types are kept in two bits each in the header, hitID is never set and not stored.
+    struct PackedPathHeader
+    {
+        uint32_t transmitterID;
+        uint32_t receiverID;
+        float timeDelay;
+        uint16_t numInteractions;
+        uint16_t types;
+        uint32_t firstInteraction;
+    };
+
+    struct PackedInteraction
+    {
+        glm::vec3 position;
+        glm::vec3 normal;
+        uint32_t ieID;
+        uint32_t label;
+        uint32_t materialID;
+        float curvature;
+    };
+
+    inline __device__ InteractionType GetPackedInteractionType(const PackedPathHeader& header, uint32_t interactionIndex)
+    {
+        return static_cast<InteractionType>((header.types >> (2 * interactionIndex)) & 3u);
+    }
+
+    inline __device__ void UnpackPath(const PackedPathHeader& header, const PackedInteraction* interactions, TraceData& traceData)
+    {
+        traceData.transmitterID = header.transmitterID;
+        traceData.receiverID = header.receiverID;
+        traceData.numInteractions = header.numInteractions;
+        traceData.timeDelay = header.timeDelay;
+        for (uint32_t i = 0; i < header.numInteractions; ++i)
+        {
+            const PackedInteraction& packed = interactions[header.firstInteraction + i];
+            Interaction& interaction = traceData.interactions[i];
+            interaction.ieID = packed.ieID;
+            interaction.hitID = 0;
+            interaction.label = packed.label;
+            interaction.type = GetPackedInteractionType(header, i);
+            interaction.position = packed.position;
+            interaction.normal = packed.normal;
+            interaction.curvature = packed.curvature;
+            interaction.materialID = packed.materialID;
+        }
+    }
 }
\ No newline at end of file
@@ -13,6 +13,7 @@ namespace VCT
 		__device__ const glm::vec3& GetCurrentVoxel() const;
 		__device__ glm::vec3 GetTextureVoxel() const;
 		__device__ glm::vec3 GetRayDirection() const;
+		__device__ uint32_t GetOctant() const;
 
 	private:
 		__device__ float RayMarch(uint32_t additionalSteps);
@@ -64,6 +65,11 @@ namespace VCT
 		return m_RayDirection;
 	}
 
+	inline __device__ uint32_t VoxelTraverser::GetOctant() const
+	{
+		return static_cast<uint32_t>(m_LocalStepDirection.x) | (static_cast<uint32_t>(m_LocalStepDirection.y) << 1) | (static_cast<uint32_t>(m_LocalStepDirection.z) << 2);
+	}
+
 	inline __device__ float VoxelTraverser::RayMarch(uint32_t additionalSteps)
 	{
 		glm::vec3 localPosition = m_Voxel - m_CurrentVoxel;
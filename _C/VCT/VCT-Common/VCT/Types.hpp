@@ -33,6 +33,15 @@ namespace VCT
     {
     }
 
+    // ITU-R P.2040 model: relative permittivity a * f^b, conductivity c * f^d (f in GHz).
+    struct Material
+    {
+        float a = 5.24f;
+        float b = 0.0f;
+        float c = 0.0462f;
+        float d = 0.7822f;
+    };
+
     enum class IEType : uint32_t
     {
         Receiver = 0,
@@ -103,6 +112,7 @@ namespace VCT
         __device__ bool IsValidIncidentRayForDiffraction(const glm::vec3& incidentRay) const;
         __device__ bool IsValidDiffractionRay(const DiffractionRay& ray) const;
         __device__ uint32_t GetNumberOfValidDiffractionRays(const DiffractionRay* diffractionRays, const IndexInfo& diffIndexInfo) const;
+        __device__ glm::vec2 RotateDiffractionDirection(const glm::vec2& direction) const;
 
         glm::vec3 forward;
         glm::vec3 up;
@@ -119,6 +129,7 @@ namespace VCT
         glm::mat3 inverseMatrix;
         glm::vec2 localSurfaceDir2D0;
         glm::vec2 localSurfaceDir2D1;
+        glm::vec2 rayRotation;
         uint32_t firstInfoIndex;
     };
 
@@ -139,7 +150,12 @@ namespace VCT
 
     inline __device__ bool DiffractionEdge::IsValidDiffractionRay(const DiffractionRay& ray) const
     {
-        return IsValidDiffractionRay(localSurfaceDir2D0, localSurfaceDir2D1, ray.direction);
+        return IsValidDiffractionRay(localSurfaceDir2D0, localSurfaceDir2D1, RotateDiffractionDirection(ray.direction));
+    }
+
+    inline __device__ glm::vec2 DiffractionEdge::RotateDiffractionDirection(const glm::vec2& direction) const
+    {
+        return glm::vec2(direction.x * rayRotation.y + direction.y * rayRotation.x, direction.y * rayRotation.y - direction.x * rayRotation.x);
     }
 
     inline __device__ uint32_t DiffractionEdge::GetNumberOfValidDiffractionRays(const DiffractionRay* diffractionRays, const IndexInfo& diffIndexInfo) const
@@ -157,6 +173,7 @@ namespace VCT
         glm::vec3 endPoint;
         glm::vec3 startPointVoxelSpace;
         glm::vec3 endPointVoxelSpace;
+        float boundingRadius;
     };
 
     struct DiffractionRayResult
@@ -184,6 +201,9 @@ namespace VCT
     {
         glm::vec3 voxelSpaceCenter;
         IndexInfo ieIndexInfo;
+        uint32_t firstLocalEdgeIndex;
+        uint32_t firstLocalReceiverIndex;
+        IndexInfo clusterIndexInfo;
     };
 
     struct VoxelPointData
@@ -192,6 +212,14 @@ namespace VCT
         uint32_t numSurfacePoints;
         uint32_t numEdges;
         uint32_t numReceivers;
+        uint32_t surfaceOctantMask;
+    };
+
+    struct IECluster
+    {
+        glm::vec3 voxelSpaceCenter;
+        float radius;
+        IndexInfo ieIndexInfo;
     };
 
     struct PropagationPath
@@ -213,6 +241,7 @@ namespace VCT
             uint32_t edgeSegmentID;
             uint32_t surfaceLabel;
         };
+        uint32_t materialID;
     };
 
     struct IEPrimitiveInfo
@@ -232,7 +261,7 @@ namespace VCT
         VoxelWorldInfo voxelWorldInfo;
 		PointNode* pointNodes;
         uint2* ieVoxelPointNodeIndices;
-        uint2* voxelTextureData;
+        uint8_t* voxelFieldData;
         VoxelWorldInfo ieVoxelWorldInfo;
 
         VoxelInfo* voxelInfos;
@@ -240,6 +269,8 @@ namespace VCT
         OptixAabb* iePrimitives;
         IntersectableEntity* intersectableEntities;
         IEPrimitiveInfo* iePrimitiveInfos;
+        IECluster* ieClusters;
+        uint32_t* ieClusterCount;
         uint32_t* ieCount;
         uint32_t* iePointCount;
         uint32_t* iePrimitiveCount;
@@ -269,6 +300,7 @@ namespace VCT
     struct IntersectionData
     {
         __device__ bool Intersect(const glm::vec3& point, float radius, float planeIntersectionRadius) const;
+        __device__ bool IntersectCluster(const glm::vec3& center, float clusterRadius, float radius) const;
         Cone rayCone;
         Plane separationPlanes[2];
     };
@@ -282,6 +314,15 @@ namespace VCT
         return result;
     }
 
+    inline __device__ bool IntersectionData::IntersectCluster(const glm::vec3& center, float clusterRadius, float radius) const
+    {
+        bool result = true;
+        result &= rayCone.Intersect(center, radius + clusterRadius, -clusterRadius);
+        result &= separationPlanes[0].SignedDistance(center) <= clusterRadius;
+        result &= separationPlanes[1].SignedDistance(center) <= clusterRadius;
+        return result;
+    }
+
     struct VoxelTraceData
     {
         glm::vec3 rayDirection;
@@ -290,7 +331,6 @@ namespace VCT
         uint32_t localIeID;
         glm::u16vec3 localVoxel;
         glm::vec3 previousVoxel;
-        uint32_t voxelHistory[3][3][3];
         bool finished;
     };
 
@@ -299,6 +339,7 @@ namespace VCT
         TraceData traceData;
         uint32_t numDiffractions;
         float incidentIor;
+        float reflectionLoss;
     };
 
     struct PropagationData
@@ -320,6 +361,72 @@ namespace VCT
         ProcessingRequired
     };
 
+    enum class EmissionMode : uint32_t
+    {
+        Atomic = 0,
+        Count,
+        Write
+    };
+
+    struct EmissionData
+    {
+        EmissionMode mode;
+        uint32_t launchOffset;
+        uint2* counts;
+    };
+
+    enum class BeamMode : uint32_t
+    {
+        Gather = 0,
+        Prune
+    };
+
+    struct BeamCandidate
+    {
+        float timeDelay;
+        uint32_t numInteractions;
+        uint32_t numDiffractions;
+        uint32_t ieID;
+        uint32_t typeHistory;
+        glm::vec3 rayDirection;
+    };
+
+    struct BeamData
+    {
+        BeamMode mode;
+        BeamCandidate* candidates;
+        const uint8_t* keep;
+    };
+
+    // key is claimed first, the route is written next and ready is set once it can be compared.
+    struct RouteEntry
+    {
+        unsigned long long key;
+        uint32_t numPaths;
+        uint32_t maxTimeDelay;
+        uint32_t ready;
+        uint32_t transmitterID;
+        uint32_t receiverID;
+        uint16_t numInteractions;
+        uint16_t types;
+        uint32_t labels[Constants::MaximumNumberOfInteractions];
+    };
+
+    struct RouteTable
+    {
+        RouteEntry* entries;
+        uint32_t mask;
+        uint32_t maxPathsPerRoute;
+        uint32_t* numRejectedPaths;
+    };
+
+    struct ActiveRayData
+    {
+        const uint32_t* rayIndices;
+        uint32_t* nextRayIndices;
+        uint32_t numNextRays;
+    };
+
     struct RefineParams
     {
         uint32_t numIterations;
@@ -348,15 +455,51 @@ namespace VCT
     {
         const IntersectableEntity* intersectableEntities;
         const Transmitter* transmitters;
+        uint32_t numTransmitters;
+        uint32_t numReceivers;
         const Receiver* receivers;
         RayTracingParams rtParams;
         RayTracingParams refineRtParams;
     };
 
+    struct DelayBoundData
+    {
+        const float* receiverDistances;
+        float maxTimeDelay;
+        uint32_t* numPrunedRays;
+    };
+
+    struct PathLossBoundData
+    {
+        const float* reflectionLosses;
+        uint32_t numMaterials;
+        float freeSpaceLossOffset;
+        float maxPathLoss;
+        uint32_t* numPrunedRays;
+    };
+
+    struct DiffractionStatistics
+    {
+        uint32_t numEdgeHits;
+        uint32_t numEmittedRays;
+        uint32_t numInvalidRays;
+        uint32_t numCulledRays;
+    };
+
+    struct LabelVisibilityData
+    {
+        uint32_t* visibleLabels;
+        uint32_t numLabels;
+        const uint32_t* sampleIeIDs;
+        uint32_t numSamples;
+    };
+
     struct ConeTracingData
     {
         cudaTextureObject_t voxelTexture;
+        cudaTextureObject_t voxelOctantTexture;
         const VoxelInfo* voxelInfos;
+        const IECluster* ieClusters;
         VoxelWorldInfo voxelWorldInfo;
         float ieBoundingSphereRadius;
         const DiffractionEdge* diffractionEdges;
@@ -370,6 +513,11 @@ namespace VCT
         uint32_t maximumNumberOfInteractions;
         uint32_t maximumNumberOfDiffractions;
         const int32_t* depthLevel;
+        DelayBoundData delayBound;
+        PathLossBoundData pathLossBound;
+        LabelVisibilityData labelVisibility;
+        DiffractionStatistics* diffractionStatistics;
+        bool diffractionReceiverCulling;
     };
 
     struct PathData
@@ -381,6 +529,10 @@ namespace VCT
         PropagationData** propPaths;
         uint32_t* maxNumPropPaths;
         PathProcessingData* pathProcessingData;
+        const EmissionData* emissionData;
+        ActiveRayData* activeRayData;
+        RouteTable routeTable;
+        const BeamData* beamData;
     };
 
     struct VCTData
@@ -391,7 +543,8 @@ namespace VCT
         PathData pathData;
         uint8_t* transmitIndexProcessed;
         Status* status;
-        TraceData* pathsToRefine;
+        PackedPathHeader* pathsToRefine;
+        PackedInteraction* pathInteractionsToRefine;
         TraceData* refinedPaths;
         uint32_t* numRefinedPaths;
         PrimitiveNeighbors* subIePrimitiveNeighbors;
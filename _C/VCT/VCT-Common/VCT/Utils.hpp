@@ -95,6 +95,23 @@ namespace VCT::Utils
         return VoxelToWorld(coord, vwInfo.worldOrigin, vwInfo.size, vwInfo.halfSize);
     }
 
+    inline __device__ uint32_t GetIeVoxelOctantSplit(uint32_t ieVoxelFactor)
+    {
+        return (ieVoxelFactor + 1) / 2;
+    }
+
+    inline __device__ uint32_t GetIeVoxelOctant(const glm::uvec3& localIeVoxel, uint32_t ieVoxelFactor)
+    {
+        uint32_t split = GetIeVoxelOctantSplit(ieVoxelFactor);
+        return static_cast<uint32_t>(localIeVoxel.x >= split) | (static_cast<uint32_t>(localIeVoxel.y >= split) << 1) | (static_cast<uint32_t>(localIeVoxel.z >= split) << 2);
+    }
+
+    inline __device__ bool IsInVoxelKernel(const glm::vec3& voxel, const glm::vec3& kernelCenterVoxel)
+    {
+        glm::vec3 diff = glm::abs(voxel - kernelCenterVoxel);
+        return (glm::max)((glm::max)(diff.x, diff.y), diff.z) <= 1.0f;
+    }
+
     template <typename Type>
     inline __device__ float DistanceSquared(const Type& a, const Type& b)
     {
@@ -0,0 +1,462 @@
+#include "EdgeExtractor.hpp"
+#include "Common.hpp"
+#include <algorithm>
+#include <atomic>
+#include <future>
+#include <limits>
+#include <numeric>
+#include <thread>
+#include <unordered_map>
+
+namespace
+{
+    using namespace VCT;
+
+    constexpr uint64_t CellCoordinateBits = 21;
+    constexpr int32_t CellCoordinateOffset = 1 << (CellCoordinateBits - 1);
+
+    #define ASSERT_EDGE_SETTING(Result, ExpectedCondition, ...) if (!(ExpectedCondition)) { LOG(__VA_ARGS__); Result = false; }
+
+    struct Patch
+    {
+        glm::vec3 centroid;
+        glm::vec3 normal;
+        uint32_t label;
+        uint32_t material;
+        std::vector<uint32_t> pointIndices;
+    };
+
+    struct EdgeSegment
+    {
+        glm::vec3 start;
+        glm::vec3 end;
+        glm::vec3 normal0;
+        glm::vec3 normal1;
+        uint32_t material0;
+        uint32_t material1;
+        uint64_t labelKey;
+    };
+
+    uint64_t PackCell(const glm::ivec3& cell)
+    {
+        glm::u64vec3 c = glm::u64vec3(cell + CellCoordinateOffset);
+        return c.x | (c.y << CellCoordinateBits) | (c.z << (2 * CellCoordinateBits));
+    }
+
+    glm::ivec3 UnpackCell(uint64_t key)
+    {
+        glm::u64vec3 c = glm::u64vec3(key, key >> CellCoordinateBits, key >> (2 * CellCoordinateBits)) & glm::u64vec3((1ull << CellCoordinateBits) - 1);
+        return glm::ivec3(c) - CellCoordinateOffset;
+    }
+
+    uint32_t DominantAxis(const glm::vec3& v)
+    {
+        glm::vec3 a = glm::abs(v);
+        return a.x >= a.y && a.x >= a.z ? 0 : (a.y >= a.z ? 1 : 2);
+    }
+
+    template <typename Func>
+    void ParallelFor(size_t count, uint32_t numThreads, const Func& func)
+    {
+        std::atomic<size_t> next{ 0 };
+        std::vector<std::future<void>> workers;
+        for (uint32_t i = 0; i < numThreads; ++i)
+        {
+            workers.push_back(std::async(std::launch::async, [&]()
+            {
+                for (size_t index = next++; index < count; index = next++)
+                    func(index);
+            }));
+        }
+        for (auto& worker : workers)
+            worker.get();
+    }
+
+    bool ValidateSettings(const EdgeExtractionSettings& settings, size_t numPoints)
+    {
+        bool result = true;
+        ASSERT_EDGE_SETTING(result, settings.voxelSize > 0.0f, "EdgeExtractionSettings: Voxel size should be > 0. Current: %f", settings.voxelSize);
+        ASSERT_EDGE_SETTING(result, settings.minEdgeAngle > 0.0f && settings.minEdgeAngle < 90.0f, "EdgeExtractionSettings: MinEdgeAngle should be in (0, 90). Current: %f", settings.minEdgeAngle);
+        ASSERT_EDGE_SETTING(result, settings.normalClusterAngle > 0.0f && settings.normalClusterAngle < 90.0f, "EdgeExtractionSettings: NormalClusterAngle should be in (0, 90). Current: %f", settings.normalClusterAngle);
+        ASSERT_EDGE_SETTING(result, settings.minPatchPoints >= 3, "EdgeExtractionSettings: MinPatchPoints should be >= 3. Current: %u", settings.minPatchPoints);
+        ASSERT_EDGE_SETTING(result, settings.maxPlaneDistance >= 0.0f, "EdgeExtractionSettings: MaxPlaneDistance should be >= 0. Current: %f", settings.maxPlaneDistance);
+        ASSERT_EDGE_SETTING(result, settings.minEdgeLength >= 0.0f, "EdgeExtractionSettings: MinEdgeLength should be >= 0. Current: %f", settings.minEdgeLength);
+        ASSERT_EDGE_SETTING(result, numPoints <= std::numeric_limits<uint32_t>::max(), "EdgeExtractor: Too many points: %zu", numPoints);
+        return result;
+    }
+
+    std::vector<Patch> FitPatches(const PointData* points, const uint32_t* first, const uint32_t* last, const EdgeExtractionSettings& settings)
+    {
+        float cosClusterAngle = std::cos(glm::radians(settings.normalClusterAngle));
+        std::vector<uint32_t> indices(first, last);
+        std::sort(indices.begin(), indices.end(), [&](uint32_t a, uint32_t b) { return points[a].label < points[b].label; });
+
+        std::vector<Patch> patches;
+        std::vector<glm::vec3> normalSums;
+        std::vector<std::vector<uint32_t>> clusters;
+        for (size_t labelFirst = 0; labelFirst < indices.size();)
+        {
+            uint32_t label = points[indices[labelFirst]].label;
+            size_t labelLast = labelFirst;
+
+            normalSums.clear();
+            clusters.clear();
+            for (; labelLast < indices.size() && points[indices[labelLast]].label == label; ++labelLast)
+            {
+                const PointData& point = points[indices[labelLast]];
+                if (glm::dot(point.normal, point.normal) < 0.25f)
+                    continue;
+
+                glm::vec3 normal = glm::normalize(point.normal);
+                size_t cluster = 0;
+                for (; cluster < clusters.size(); ++cluster)
+                {
+                    if (glm::dot(glm::normalize(normalSums[cluster]), normal) >= cosClusterAngle)
+                        break;
+                }
+                if (cluster == clusters.size())
+                {
+                    normalSums.push_back(glm::vec3(0.0f));
+                    clusters.emplace_back();
+                }
+                normalSums[cluster] += normal;
+                clusters[cluster].push_back(indices[labelLast]);
+            }
+            labelFirst = labelLast;
+
+            for (size_t cluster = 0; cluster < clusters.size(); ++cluster)
+            {
+                if (clusters[cluster].size() < settings.minPatchPoints)
+                    continue;
+
+                Patch patch{};
+                patch.normal = glm::normalize(normalSums[cluster]);
+                patch.label = label;
+                patch.material = points[clusters[cluster].front()].material;
+                for (uint32_t pointIndex : clusters[cluster])
+                    patch.centroid += points[pointIndex].position;
+                patch.centroid /= static_cast<float>(clusters[cluster].size());
+
+                float residual = 0.0f;
+                for (uint32_t pointIndex : clusters[cluster])
+                    residual += std::abs(glm::dot(patch.normal, points[pointIndex].position - patch.centroid));
+                if (residual > settings.maxPlaneDistance * clusters[cluster].size())
+                    continue;
+
+                patch.pointIndices = std::move(clusters[cluster]);
+                patches.push_back(std::move(patch));
+            }
+        }
+        return patches;
+    }
+
+    bool ProjectPatch(const Patch& patch, const PointData* points, const glm::vec3& linePoint, const glm::vec3& direction, float maxDistance, glm::vec2& range)
+    {
+        range = glm::vec2(std::numeric_limits<float>::max(), std::numeric_limits<float>::lowest());
+        uint32_t count = 0;
+        for (uint32_t pointIndex : patch.pointIndices)
+        {
+            glm::vec3 v = points[pointIndex].position - linePoint;
+            float t = glm::dot(v, direction);
+            if (glm::length(v - direction * t) > maxDistance)
+                continue;
+            range = glm::vec2(glm::min(range.x, t), glm::max(range.y, t));
+            ++count;
+        }
+        return count > 1;
+    }
+
+    bool IntersectPatches(const Patch& patch0, const Patch& patch1, const PointData* points, const EdgeExtractionSettings& settings, EdgeSegment& segment)
+    {
+        float sinMinEdgeAngle = std::sin(glm::radians(settings.minEdgeAngle));
+        glm::vec3 direction = glm::cross(patch0.normal, patch1.normal);
+        float directionLength2 = glm::dot(direction, direction);
+        if (directionLength2 < sinMinEdgeAngle * sinMinEdgeAngle)
+            return false;
+
+        float side0 = glm::dot(patch0.normal, patch1.centroid - patch0.centroid);
+        float side1 = glm::dot(patch1.normal, patch0.centroid - patch1.centroid);
+        bool convex = side0 < 0.0f && side1 < 0.0f;
+        bool concave = side0 > 0.0f && side1 > 0.0f;
+        if (!convex && !(concave && settings.includeConcave))
+            return false;
+
+        float h0 = glm::dot(patch0.normal, patch0.centroid);
+        float h1 = glm::dot(patch1.normal, patch1.centroid);
+        glm::vec3 linePoint = (h0 * glm::cross(patch1.normal, direction) + h1 * glm::cross(direction, patch0.normal)) / directionLength2;
+
+        bool swapFaces = direction[DominantAxis(direction)] < 0.0f;
+        direction = glm::normalize(swapFaces ? -direction : direction);
+        linePoint += direction * glm::dot((patch0.centroid + patch1.centroid) * 0.5f - linePoint, direction);
+
+        glm::vec2 range0, range1;
+        if (!ProjectPatch(patch0, points, linePoint, direction, settings.voxelSize, range0) ||
+            !ProjectPatch(patch1, points, linePoint, direction, settings.voxelSize, range1))
+            return false;
+
+        float t0 = glm::max(range0.x, range1.x);
+        float t1 = glm::min(range0.y, range1.y);
+        if (t1 <= t0)
+            return false;
+
+        const Patch& face0 = swapFaces ? patch1 : patch0;
+        const Patch& face1 = swapFaces ? patch0 : patch1;
+        segment.start = linePoint + direction * t0;
+        segment.end = linePoint + direction * t1;
+        segment.normal0 = face0.normal;
+        segment.normal1 = face1.normal;
+        segment.material0 = face0.material;
+        segment.material1 = face1.material;
+        segment.labelKey = (static_cast<uint64_t>(glm::min(patch0.label, patch1.label)) << 32) | glm::max(patch0.label, patch1.label);
+        return true;
+    }
+
+    uint32_t FindRoot(std::vector<uint32_t>& parents, uint32_t index)
+    {
+        while (parents[index] != index)
+        {
+            parents[index] = parents[parents[index]];
+            index = parents[index];
+        }
+        return index;
+    }
+
+    bool CanMergeSegments(const EdgeSegment& segment0, const EdgeSegment& segment1, float cosMergeAngle, float maxDistance)
+    {
+        glm::vec3 dir0 = segment0.end - segment0.start;
+        float length0 = glm::length(dir0);
+        dir0 /= length0;
+        glm::vec3 dir1 = glm::normalize(segment1.end - segment1.start);
+
+        float cosAngle = glm::dot(dir0, dir1);
+        if (std::abs(cosAngle) < cosMergeAngle)
+            return false;
+
+        glm::vec3 normal0 = cosAngle < 0.0f ? segment1.normal1 : segment1.normal0;
+        glm::vec3 normal1 = cosAngle < 0.0f ? segment1.normal0 : segment1.normal1;
+        if (glm::dot(segment0.normal0, normal0) < cosMergeAngle || glm::dot(segment0.normal1, normal1) < cosMergeAngle)
+            return false;
+
+        glm::vec3 mid = (segment1.start + segment1.end) * 0.5f - segment0.start;
+        if (glm::length(mid - dir0 * glm::dot(mid, dir0)) > maxDistance)
+            return false;
+
+        float a = glm::dot(segment1.start - segment0.start, dir0);
+        float b = glm::dot(segment1.end - segment0.start, dir0);
+        float gap = glm::max(glm::min(a, b) - length0, -glm::max(a, b));
+        return gap <= maxDistance;
+    }
+
+    void MergeSegments(const std::vector<EdgeSegment>& segments, std::vector<uint32_t> group, const EdgeExtractionSettings& settings, std::vector<ExtractedEdge>& edges)
+    {
+        float cosMergeAngle = std::cos(glm::radians(settings.normalClusterAngle));
+        float maxDistance = settings.voxelSize;
+
+        // Sorting by the midpoint along the dominant axis keeps candidate pairs within a window of one segment length plus the allowed gap.
+        auto sortKey = [&](uint32_t index)
+        {
+            const EdgeSegment& segment = segments[index];
+            uint32_t axis = DominantAxis(segment.end - segment.start);
+            return std::make_pair(axis, (segment.start[axis] + segment.end[axis]) * 0.5f);
+        };
+        std::sort(group.begin(), group.end(), [&](uint32_t a, uint32_t b) { return sortKey(a) < sortKey(b); });
+
+        float maxLength = 0.0f;
+        for (uint32_t index : group)
+            maxLength = glm::max(maxLength, glm::length(segments[index].end - segments[index].start));
+
+        std::vector<uint32_t> parents(group.size());
+        std::iota(parents.begin(), parents.end(), 0);
+        for (uint32_t i = 0; i < group.size(); ++i)
+        {
+            auto key = sortKey(group[i]);
+            for (uint32_t j = i + 1; j < group.size(); ++j)
+            {
+                auto otherKey = sortKey(group[j]);
+                if (otherKey.first != key.first || otherKey.second - key.second > maxLength + maxDistance)
+                    break;
+                if (CanMergeSegments(segments[group[i]], segments[group[j]], cosMergeAngle, maxDistance))
+                    parents[FindRoot(parents, j)] = FindRoot(parents, i);
+            }
+        }
+
+        std::unordered_map<uint32_t, std::vector<uint32_t>> components;
+        std::vector<uint32_t> roots;
+        for (uint32_t i = 0; i < group.size(); ++i)
+        {
+            uint32_t root = FindRoot(parents, i);
+            auto& members = components[root];
+            if (members.empty())
+                roots.push_back(root);
+            members.push_back(group[i]);
+        }
+
+        for (uint32_t root : roots)
+        {
+            const std::vector<uint32_t>& members = components[root];
+            const EdgeSegment& reference = segments[members.front()];
+            glm::vec3 referenceDir = reference.end - reference.start;
+
+            glm::vec3 direction(0.0f), center(0.0f), normal0(0.0f), normal1(0.0f);
+            float totalLength = 0.0f, longestLength = 0.0f;
+            uint32_t material0 = reference.material0, material1 = reference.material1;
+            for (uint32_t index : members)
+            {
+                const EdgeSegment& segment = segments[index];
+                glm::vec3 dir = segment.end - segment.start;
+                float length = glm::length(dir);
+                bool flipped = glm::dot(dir, referenceDir) < 0.0f;
+                direction += flipped ? -dir : dir;
+                center += (segment.start + segment.end) * 0.5f * length;
+                normal0 += (flipped ? segment.normal1 : segment.normal0) * length;
+                normal1 += (flipped ? segment.normal0 : segment.normal1) * length;
+                totalLength += length;
+                if (length > longestLength)
+                {
+                    longestLength = length;
+                    material0 = flipped ? segment.material1 : segment.material0;
+                    material1 = flipped ? segment.material0 : segment.material1;
+                }
+            }
+            direction = glm::normalize(direction);
+            center /= totalLength;
+
+            float t0 = std::numeric_limits<float>::max(), t1 = std::numeric_limits<float>::lowest();
+            for (uint32_t index : members)
+            {
+                for (const glm::vec3& p : { segments[index].start, segments[index].end })
+                {
+                    float t = glm::dot(p - center, direction);
+                    t0 = glm::min(t0, t);
+                    t1 = glm::max(t1, t);
+                }
+            }
+            if (t1 - t0 < settings.minEdgeLength)
+                continue;
+
+            edges.push_back({ center + direction * t0, center + direction * t1, glm::normalize(normal0), glm::normalize(normal1), material0, material1 });
+        }
+    }
+}
+
+namespace VCT
+{
+    std::vector<ExtractedEdge> ExtractEdges(const PointData* points, size_t numPoints, const EdgeExtractionSettings& settings)
+    {
+        PROFILE_SCOPE();
+        if (!ValidateSettings(settings, numPoints))
+            return {};
+        uint32_t numThreads = settings.numThreads ? settings.numThreads : glm::max(std::thread::hardware_concurrency(), 1u);
+
+        std::vector<std::pair<uint64_t, uint32_t>> cellPoints(numPoints);
+        for (uint32_t pointIndex = 0; pointIndex < numPoints; ++pointIndex)
+        {
+            glm::vec3 cell = glm::floor(points[pointIndex].position / settings.voxelSize);
+            if (!glm::all(glm::lessThan(glm::abs(cell), glm::vec3(CellCoordinateOffset))))
+            {
+                LOG("EdgeExtractor: Point %u lies outside the addressable range for voxel size %f.", pointIndex, settings.voxelSize);
+                return {};
+            }
+            cellPoints[pointIndex] = { PackCell(glm::ivec3(cell)), pointIndex };
+        }
+        std::sort(cellPoints.begin(), cellPoints.end());
+
+        std::vector<uint32_t> pointIndices(numPoints);
+        std::vector<uint64_t> cellKeys;
+        std::vector<uint32_t> cellFirst;
+        for (uint32_t i = 0; i < numPoints; ++i)
+        {
+            pointIndices[i] = cellPoints[i].second;
+            if (i == 0 || cellPoints[i].first != cellPoints[i - 1].first)
+            {
+                cellKeys.push_back(cellPoints[i].first);
+                cellFirst.push_back(i);
+            }
+        }
+        cellFirst.push_back(static_cast<uint32_t>(numPoints));
+        cellPoints = {};
+
+        std::unordered_map<uint64_t, uint32_t> cellIndices;
+        cellIndices.reserve(cellKeys.size());
+        for (uint32_t cellIndex = 0; cellIndex < cellKeys.size(); ++cellIndex)
+            cellIndices[cellKeys[cellIndex]] = cellIndex;
+
+        std::vector<std::vector<Patch>> cellPatches(cellKeys.size());
+        ParallelFor(cellKeys.size(), numThreads, [&](size_t cellIndex)
+        {
+            cellPatches[cellIndex] = FitPatches(points, pointIndices.data() + cellFirst[cellIndex], pointIndices.data() + cellFirst[cellIndex + 1], settings);
+        });
+
+        // Each unordered pair of neighbouring cells is visited once: the cell itself plus the 13 neighbours that follow it.
+        std::vector<glm::ivec3> neighborOffsets;
+        for (int32_t z = -1; z <= 1; ++z)
+            for (int32_t y = -1; y <= 1; ++y)
+                for (int32_t x = -1; x <= 1; ++x)
+                    if (z > 0 || (z == 0 && (y > 0 || (y == 0 && x > 0))))
+                        neighborOffsets.push_back(glm::ivec3(x, y, z));
+
+        std::vector<std::vector<EdgeSegment>> cellSegments(cellKeys.size());
+        ParallelFor(cellKeys.size(), numThreads, [&](size_t cellIndex)
+        {
+            const std::vector<Patch>& patches = cellPatches[cellIndex];
+            if (patches.empty())
+                return;
+
+            glm::ivec3 cell = UnpackCell(cellKeys[cellIndex]);
+            EdgeSegment segment{};
+            for (size_t i = 0; i < patches.size(); ++i)
+            {
+                for (size_t j = i + 1; j < patches.size(); ++j)
+                {
+                    if (IntersectPatches(patches[i], patches[j], points, settings, segment))
+                        cellSegments[cellIndex].push_back(segment);
+                }
+            }
+            for (const glm::ivec3& offset : neighborOffsets)
+            {
+                auto it = cellIndices.find(PackCell(cell + offset));
+                if (it == cellIndices.end())
+                    continue;
+                for (const Patch& patch : patches)
+                {
+                    for (const Patch& neighborPatch : cellPatches[it->second])
+                    {
+                        if (IntersectPatches(patch, neighborPatch, points, settings, segment))
+                            cellSegments[cellIndex].push_back(segment);
+                    }
+                }
+            }
+        });
+
+        size_t numPatches = 0;
+        std::vector<EdgeSegment> segments;
+        for (uint32_t cellIndex = 0; cellIndex < cellKeys.size(); ++cellIndex)
+        {
+            numPatches += cellPatches[cellIndex].size();
+            segments.insert(segments.end(), cellSegments[cellIndex].begin(), cellSegments[cellIndex].end());
+        }
+
+        std::unordered_map<uint64_t, std::vector<uint32_t>> groups;
+        for (uint32_t segmentIndex = 0; segmentIndex < segments.size(); ++segmentIndex)
+            groups[segments[segmentIndex].labelKey].push_back(segmentIndex);
+
+        std::vector<uint64_t> groupKeys;
+        groupKeys.reserve(groups.size());
+        for (const auto& [key, group] : groups)
+            groupKeys.push_back(key);
+        std::sort(groupKeys.begin(), groupKeys.end());
+
+        std::vector<std::vector<ExtractedEdge>> groupEdges(groupKeys.size());
+        ParallelFor(groupKeys.size(), numThreads, [&](size_t groupIndex)
+        {
+            MergeSegments(segments, groups.at(groupKeys[groupIndex]), settings, groupEdges[groupIndex]);
+        });
+
+        std::vector<ExtractedEdge> edges;
+        for (const std::vector<ExtractedEdge>& group : groupEdges)
+            edges.insert(edges.end(), group.begin(), group.end());
+
+        LOG("Edge extraction: %zu points, %zu cells, %zu patches, %zu segments, %zu edges", numPoints, cellKeys.size(), numPatches, segments.size(), edges.size());
+        return edges;
+    }
+}
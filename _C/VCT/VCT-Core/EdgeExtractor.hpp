@@ -0,0 +1,31 @@
+#pragma once
+#include "Types.hpp"
+#include <vector>
+
+namespace VCT
+{
+    struct EdgeExtractionSettings
+    {
+        float voxelSize = 0.1f;
+        float minEdgeAngle = 20.0f;
+        float normalClusterAngle = 10.0f;
+        uint32_t minPatchPoints = 10;
+        float maxPlaneDistance = 0.02f;
+        float minEdgeLength = 0.1f;
+        bool includeConcave = false;
+        uint32_t numThreads = 0;
+    };
+
+    struct ExtractedEdge
+    {
+        glm::vec3 start;
+        glm::vec3 end;
+        glm::vec3 normal0;
+        glm::vec3 normal1;
+        uint32_t material0;
+        uint32_t material1;
+    };
+
+    // Finds diffraction edges at label boundaries and normal discontinuities by intersecting planar patches fitted per voxel.
+    std::vector<ExtractedEdge> ExtractEdges(const PointData* points, size_t numPoints, const EdgeExtractionSettings& settings);
+}
@@ -33,6 +33,19 @@ namespace VCT
 
 		uint32_t blockSize = 32;
 		uint32_t numCoarsePathsPerUniqueRoute = 100;
+		bool useDirectionalSkipDistances = false;
+		bool deterministicEmission = false;
+		uint32_t beamWidth = 0;
+		uint32_t rayMergeLimit = 0;
+		float rayMergeDirectionResolution = 0.05f;
+		float maxTimeDelay = 0.0f;
+		float maxPathLoss = 0.0f;
+		bool bidirectionalSearch = false;
+		uint32_t labelVisibilitySamples = 0;
+		bool diffractionReceiverCulling = false;
+		uint32_t edgeSegmentMergeCount = 1;
+		uint32_t coarsePathMemoryLimitMB = 0;
+		std::string pathSpillDirectory;
 	};
 
 	struct Object3D
@@ -75,6 +88,7 @@ namespace VCT
 		}
 
 		SceneSettings sceneSettings;
+		std::vector<Material> materials;
 		uint32_t numInteractions;
 		uint32_t numDiffractions;
 	};
@@ -28,7 +28,9 @@ namespace VCT
             && s_KernelData->m_RtModule
             && s_KernelData->m_TransmitPipeline
             && s_KernelData->m_PropagationPipeline
-            && s_KernelData->m_RefinePipeline;
+            && s_KernelData->m_RefinePipeline
+            && s_KernelData->m_BeamPipeline
+            && s_KernelData->m_LabelVisibilityPipeline;
     }
 
     void KernelData::Destroy()
@@ -83,6 +85,12 @@ namespace VCT
         pgDescs[0].raygen.entryFunctionName = "__raygen__VCT";
         m_PropagationPipeline = RTPipeline(pgDescs.data(), pgDescs.size(), pipelineCompileOptions, pipelineLinkOptions);
 
+        pgDescs[0].raygen.entryFunctionName = "__raygen__Beam";
+        m_BeamPipeline = RTPipeline(pgDescs.data(), pgDescs.size(), pipelineCompileOptions, pipelineLinkOptions);
+
+        pgDescs[0].raygen.entryFunctionName = "__raygen__LabelVisibility";
+        m_LabelVisibilityPipeline = RTPipeline(pgDescs.data(), pgDescs.size(), pipelineCompileOptions, pipelineLinkOptions);
+
         pgDescs[0].raygen.entryFunctionName = "__raygen__Refine";
         pgDescs[1].miss.entryFunctionName = "__miss__Refine";
         pgDescs[2].hitgroup.entryFunctionNameIS = "__intersection__Refine";
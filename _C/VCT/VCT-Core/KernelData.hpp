@@ -24,6 +24,8 @@ namespace VCT
 		const RTPipeline& GetTransmitPipeline() const { return m_TransmitPipeline; }
 		const RTPipeline& GetPropagationPipeline() const { return m_PropagationPipeline; }
 		const RTPipeline& GetRefinePipeline() const { return m_RefinePipeline; }
+		const RTPipeline& GetBeamPipeline() const { return m_BeamPipeline; }
+		const RTPipeline& GetLabelVisibilityPipeline() const { return m_LabelVisibilityPipeline; }
 
 	private:
 		KernelData();
@@ -42,5 +44,7 @@ namespace VCT
 		RTPipeline m_TransmitPipeline;
 		RTPipeline m_PropagationPipeline;
 		RTPipeline m_RefinePipeline;
+		RTPipeline m_BeamPipeline;
+		RTPipeline m_LabelVisibilityPipeline;
 	};
 }
\ No newline at end of file
@@ -2,15 +2,49 @@
 #include "Utils.hpp"
 #include "Traversal.hpp"
 #include <numeric>
+#include <algorithm>
+#include <complex>
+#include <bitset>
+#include <array>
+#include <unordered_set>
 #include <future>
+#include <atomic>
 #include <filesystem>
 #include <fstream>
+#include <stdexcept>
 #include "KernelData.hpp"
 
+namespace
+{
+    // Rays that share an IE and interaction type history follow the same route prefix.
+    struct RayRouteKey
+    {
+        explicit RayRouteKey(const VCT::BeamCandidate& candidate) : ieID(candidate.ieID), numInteractions(candidate.numInteractions), typeHistory(candidate.typeHistory) {}
+        bool operator==(const RayRouteKey& other) const { return ieID == other.ieID && numInteractions == other.numInteractions && typeHistory == other.typeHistory; }
+
+        uint32_t ieID;
+        uint32_t numInteractions;
+        uint32_t typeHistory;
+    };
+
+    struct RayMergeKey
+    {
+        bool operator==(const RayMergeKey& other) const { return route == other.route && direction == other.direction; }
+
+        RayRouteKey route;
+        glm::ivec3 direction;
+    };
+}
+
+MAKE_HASHABLE(RayRouteKey, t.ieID, t.numInteractions, t.typeHistory)
+MAKE_HASHABLE(RayMergeKey, t.route, t.direction.x, t.direction.y, t.direction.z)
+
 namespace
 {
     #define ASSERT_VCT_PARAM(Result, ExpectedCondition, ...) if (!(ExpectedCondition)) { LOG(__VA_ARGS__); Result = false; }
 
+    constexpr uint64_t MaximumLabelVisibilityBits = 1ull << 28;
+
     bool ValidateParams(const VCTParams& params)
     {
         bool result = true;
@@ -22,6 +56,10 @@ namespace
         ASSERT_VCT_PARAM(result, params.receivedPathBufferSize > 0, "ReceivedPathBufferSize should be greater than 0");
         ASSERT_VCT_PARAM(result, params.propagationPathBufferSize > 0, "PropagationPathBufferSize should be greater than 0");
         ASSERT_VCT_PARAM(result, params.propagationBufferSizeIncreaseFactor >= 1.0f, "PropagationBufferSizeIncreaseFactor should be >= 1");
+        ASSERT_VCT_PARAM(result, params.rayMergeLimit == 0 || params.rayMergeDirectionResolution > 0.0f, "RayMergeDirectionResolution should be > 0");
+        ASSERT_VCT_PARAM(result, params.maxTimeDelay >= 0.0f, "MaxTimeDelay should be >= 0");
+        ASSERT_VCT_PARAM(result, params.frequency > 0.0f, "Frequency should be greater than 0");
+        ASSERT_VCT_PARAM(result, params.maxPathLoss >= 0.0f, "MaxPathLoss should be >= 0");
         ASSERT_VCT_PARAM(result, params.refineParams.distanceThreshold >= 0.0f, "DistanceThreshold should be >= 0");
         ASSERT_VCT_PARAM(result, params.refineParams.angleThreshold >= 0.0f, "AngleThreshold should be >= 0");
         ASSERT_VCT_PARAM(result, params.refineParams.alpha > 0.0f && params.refineParams.alpha < 1.0, "Alpha should be greater than 0 and less than 1");
@@ -68,6 +106,317 @@ namespace
 
         return (rads0 - rads1 < glm::pi<float>() ? rads0 : rads1);
     }
+
+    template <typename Type>
+    cudaTextureObject_t CreateTexture(const VCT::DeviceBuffer& buffer, const glm::uvec3& dimensions, uint32_t borderColor, cudaResourceViewFormat viewFormat)
+    {
+        cudaArray* arr;
+        cudaExtent extent = make_cudaExtent(dimensions.x, dimensions.y, dimensions.z);
+        cudaChannelFormatDesc desc = cudaCreateChannelDesc<Type>();
+        CUDA_CHECK(cudaMalloc3DArray(&arr, &desc, extent, 0));
+
+        cudaMemcpy3DParms copyParams{};
+        copyParams.srcPtr = make_cudaPitchedPtr(buffer.DevicePointerCast<void>(), extent.width * sizeof(Type), extent.width, extent.height);
+        copyParams.dstArray = arr;
+        copyParams.extent = extent;
+        copyParams.kind = cudaMemcpyDeviceToDevice;
+        CUDA_CHECK(cudaMemcpy3D(&copyParams));
+        CUDA_CHECK(cudaDeviceSynchronize());
+
+        cudaResourceDesc resourceDesc{};
+        resourceDesc.resType = cudaResourceTypeArray;
+        resourceDesc.res.array.array = arr;
+
+        cudaTextureDesc textureDesc{};
+        textureDesc.addressMode[0] = cudaAddressModeBorder;
+        textureDesc.addressMode[1] = cudaAddressModeBorder;
+        textureDesc.addressMode[2] = cudaAddressModeBorder;
+        textureDesc.filterMode = cudaFilterModePoint;
+        textureDesc.readMode = cudaReadModeElementType;
+        textureDesc.sRGB = false;
+        textureDesc.borderColor[0] = reinterpret_cast<float&>(borderColor);
+        textureDesc.borderColor[1] = reinterpret_cast<float&>(borderColor);
+        textureDesc.normalizedCoords = false;
+        textureDesc.maxAnisotropy = 0;
+        textureDesc.mipmapFilterMode = cudaFilterModePoint;
+        textureDesc.mipmapLevelBias = 0.0f;
+        textureDesc.minMipmapLevelClamp = 0.0f;
+        textureDesc.maxMipmapLevelClamp = 0.0f;
+
+        cudaResourceViewDesc viewDesc{};
+        viewDesc.format = viewFormat;
+        viewDesc.width = dimensions.x;
+        viewDesc.height = dimensions.y;
+        viewDesc.depth = dimensions.z;
+        viewDesc.firstMipmapLevel = 0;
+        viewDesc.lastMipmapLevel = 0;
+        viewDesc.firstLayer = 0;
+        viewDesc.lastLayer = 0;
+
+        cudaTextureObject_t texture = 0;
+        CUDA_CHECK(cudaCreateTextureObject(&texture, &resourceDesc, &textureDesc, &viewDesc));
+        return texture;
+    }
+
+    class ReceiverGrid
+    {
+    public:
+        ReceiverGrid(const std::vector<VCT::Receiver>& receivers)
+            : m_Min(receivers.front().position)
+            , m_Max(receivers.front().position)
+        {
+            for (const VCT::Receiver& rx : receivers)
+            {
+                m_Min = glm::min(m_Min, rx.position);
+                m_Max = glm::max(m_Max, rx.position);
+            }
+            glm::vec3 extent = m_Max - m_Min;
+            m_CellSize = glm::max(glm::max(extent.x, glm::max(extent.y, extent.z)) / glm::max(std::cbrt(static_cast<float>(receivers.size())), 1.0f), 1e-3f);
+            m_Dimensions = glm::ivec3(extent / m_CellSize) + 1;
+
+            m_CellStarts.resize(static_cast<size_t>(m_Dimensions.x) * m_Dimensions.y * m_Dimensions.z + 1, 0);
+            for (const VCT::Receiver& rx : receivers)
+                ++m_CellStarts[GetCellIndex(GetCell(rx.position)) + 1];
+
+            std::partial_sum(m_CellStarts.begin(), m_CellStarts.end(), m_CellStarts.begin());
+            std::vector<uint32_t> cellOffsets(m_CellStarts.begin(), m_CellStarts.end() - 1);
+            m_Positions.resize(receivers.size());
+            for (const VCT::Receiver& rx : receivers)
+                m_Positions[cellOffsets[GetCellIndex(GetCell(rx.position))]++] = rx.position;
+        }
+
+        float GetNearestDistance(const glm::vec3& position) const
+        {
+            glm::vec3 projected = glm::clamp(position, m_Min, m_Max);
+            float projectedDistanceSq = glm::dot(position - projected, position - projected);
+            glm::ivec3 startCell = GetCell(projected);
+            float bestDistanceSq = std::numeric_limits<float>::max();
+            int32_t maxRing = glm::max(m_Dimensions.x, glm::max(m_Dimensions.y, m_Dimensions.z));
+            for (int32_t ring = 0; ring <= maxRing; ++ring)
+            {
+                float ringDistance = glm::max(ring - 1, 0) * m_CellSize;
+                if (bestDistanceSq <= projectedDistanceSq + ringDistance * ringDistance)
+                    break;
+
+                glm::ivec3 first = glm::max(startCell - ring, glm::ivec3(0));
+                glm::ivec3 last = glm::min(startCell + ring, m_Dimensions - 1);
+                for (int32_t z = first.z; z <= last.z; ++z)
+                    for (int32_t y = first.y; y <= last.y; ++y)
+                        for (int32_t x = first.x; x <= last.x; ++x)
+                        {
+                            glm::ivec3 offset = glm::abs(glm::ivec3(x, y, z) - startCell);
+                            if (glm::max(offset.x, glm::max(offset.y, offset.z)) != ring)
+                                continue;
+
+                            uint32_t cellIndex = GetCellIndex(glm::ivec3(x, y, z));
+                            for (uint32_t i = m_CellStarts[cellIndex]; i < m_CellStarts[cellIndex + 1]; ++i)
+                                bestDistanceSq = glm::min(bestDistanceSq, glm::dot(position - m_Positions[i], position - m_Positions[i]));
+                        }
+            }
+            return std::sqrt(bestDistanceSq);
+        }
+
+    private:
+        glm::ivec3 GetCell(const glm::vec3& position) const { return glm::clamp(glm::ivec3((position - m_Min) / m_CellSize), glm::ivec3(0), m_Dimensions - 1); }
+        uint32_t GetCellIndex(const glm::ivec3& cell) const { return static_cast<uint32_t>((cell.z * m_Dimensions.y + cell.y) * m_Dimensions.x + cell.x); }
+
+    private:
+        glm::vec3 m_Min;
+        glm::vec3 m_Max;
+        float m_CellSize;
+        glm::ivec3 m_Dimensions;
+        std::vector<uint32_t> m_CellStarts;
+        std::vector<glm::vec3> m_Positions;
+    };
+
+    // A diffraction emits a fan of rays that share every interaction and only differ in direction. Joining only looks at the
+    // interactions, so every ray of a fan would produce the same joined paths. Keeps the first ray of each route.
+    uint32_t RemoveDuplicateFrontierRays(std::vector<VCT::TraceProcessingData>& rays)
+    {
+        auto hashRoute = [&rays](uint32_t rayIndex)
+        {
+            const VCT::TraceData& traceData = rays[rayIndex].traceData;
+            size_t hash = CalculateHash(traceData.transmitterID, traceData.numInteractions);
+            for (uint32_t i = 0; i < traceData.numInteractions; ++i)
+                CombineHash(hash, traceData.interactions[i].ieID, static_cast<uint32_t>(traceData.interactions[i].type));
+            return hash;
+        };
+        auto isSameRoute = [&rays](uint32_t lhsIndex, uint32_t rhsIndex)
+        {
+            const VCT::TraceData& lhs = rays[lhsIndex].traceData;
+            const VCT::TraceData& rhs = rays[rhsIndex].traceData;
+            if (lhs.transmitterID != rhs.transmitterID || lhs.numInteractions != rhs.numInteractions)
+                return false;
+
+            for (uint32_t i = 0; i < lhs.numInteractions; ++i)
+                if (lhs.interactions[i].ieID != rhs.interactions[i].ieID || lhs.interactions[i].type != rhs.interactions[i].type)
+                    return false;
+            return true;
+        };
+
+        std::unordered_set<uint32_t, decltype(hashRoute), decltype(isSameRoute)> routes(rays.size(), hashRoute, isSameRoute);
+        std::vector<uint8_t> keep(rays.size());
+        for (uint32_t rayIndex = 0; rayIndex < static_cast<uint32_t>(rays.size()); ++rayIndex)
+            keep[rayIndex] = routes.insert(rayIndex).second;
+
+        uint32_t numRays = 0;
+        for (uint32_t rayIndex = 0; rayIndex < static_cast<uint32_t>(rays.size()); ++rayIndex)
+            if (keep[rayIndex])
+                rays[numRays++] = rays[rayIndex];
+
+        uint32_t numDuplicates = static_cast<uint32_t>(rays.size()) - numRays;
+        rays.resize(numRays);
+        return numDuplicates;
+    }
+
+    // Larger of the TE and TM power reflection coefficients. TE grows monotonically towards grazing incidence and TM has a single minimum
+    // at the Brewster angle, so the maximum over an angle interval is attained at one of its ends.
+    double CalculateReflectance(const VCT::Material& material, double frequencyGHz, double cosIncidentAngle)
+    {
+        double permittivity = material.a * std::pow(frequencyGHz, static_cast<double>(material.b));
+        double conductivity = material.c * std::pow(frequencyGHz, static_cast<double>(material.d));
+        std::complex<double> eta = std::complex<double>(permittivity, -17.98 * conductivity / frequencyGHz);
+        std::complex<double> root = std::sqrt(eta - (1.0 - cosIncidentAngle * cosIncidentAngle));
+        double te = std::norm((cosIncidentAngle - root) / (cosIncidentAngle + root));
+        double tm = std::norm((eta * cosIncidentAngle - root) / (eta * cosIncidentAngle + root));
+        return std::max(te, tm);
+    }
+
+    void ExclusiveScan(const std::vector<uint2>& values, std::vector<glm::u64vec2>& offsets)
+    {
+        constexpr size_t minChunkSize = 1 << 16;
+        size_t numChunks = std::clamp<size_t>(values.size() / minChunkSize, 1, std::max(std::thread::hardware_concurrency(), 1u));
+        size_t chunkSize = (values.size() + numChunks - 1) / numChunks;
+        std::vector<glm::u64vec2> chunkOffsets(numChunks + 1, glm::u64vec2(0));
+        std::vector<std::future<void>> tasks;
+        offsets.resize(values.size() + 1);
+
+        for (size_t chunk = 0; chunk < numChunks; ++chunk)
+        {
+            tasks.push_back(std::async(std::launch::async, [&, chunk]()
+            {
+                glm::u64vec2 total = glm::u64vec2(0);
+                for (size_t i = chunk * chunkSize; i < std::min(values.size(), (chunk + 1) * chunkSize); ++i)
+                    total += glm::u64vec2(values[i].x, values[i].y);
+                chunkOffsets[chunk + 1] = total;
+            }));
+        }
+        for (auto& task : tasks)
+            task.get();
+
+        std::partial_sum(chunkOffsets.begin(), chunkOffsets.end(), chunkOffsets.begin());
+        tasks.clear();
+
+        for (size_t chunk = 0; chunk < numChunks; ++chunk)
+        {
+            tasks.push_back(std::async(std::launch::async, [&, chunk]()
+            {
+                glm::u64vec2 offset = chunkOffsets[chunk];
+                for (size_t i = chunk * chunkSize; i < std::min(values.size(), (chunk + 1) * chunkSize); ++i)
+                {
+                    offsets[i] = offset;
+                    offset += glm::u64vec2(values[i].x, values[i].y);
+                }
+            }));
+        }
+        for (auto& task : tasks)
+            task.get();
+
+        offsets.back() = chunkOffsets.back();
+    }
+
+    // Moves the count smallest scores to the front like std::nth_element. The chunks histogram and scatter their scores in parallel;
+    // only the scores that share a bin with the count-th smallest one are ordered serially.
+    void PartitionSmallest(std::vector<std::pair<float, uint32_t>>& scores, size_t count)
+    {
+        constexpr size_t minChunkSize = 1 << 16;
+        constexpr size_t numBins = 1 << 12;
+        if (count == 0 || count >= scores.size())
+            return;
+
+        size_t numChunks = std::clamp<size_t>(scores.size() / minChunkSize, 1, std::max(std::thread::hardware_concurrency(), 1u));
+        if (numChunks == 1)
+        {
+            std::nth_element(scores.begin(), scores.begin() + count, scores.end());
+            return;
+        }
+
+        size_t chunkSize = (scores.size() + numChunks - 1) / numChunks;
+        auto forEachChunk = [&](const auto& func)
+        {
+            std::vector<std::future<void>> tasks;
+            for (size_t chunk = 0; chunk < numChunks; ++chunk)
+                tasks.push_back(std::async(std::launch::async, func, chunk, chunk * chunkSize, std::min(scores.size(), (chunk + 1) * chunkSize)));
+            for (auto& task : tasks)
+                task.get();
+        };
+
+        std::vector<glm::vec2> chunkRanges(numChunks, glm::vec2(std::numeric_limits<float>::max(), std::numeric_limits<float>::lowest()));
+        forEachChunk([&](size_t chunk, size_t first, size_t end)
+        {
+            for (size_t i = first; i < end; ++i)
+                if (std::isfinite(scores[i].first))
+                    chunkRanges[chunk] = glm::vec2(std::min(chunkRanges[chunk].x, scores[i].first), std::max(chunkRanges[chunk].y, scores[i].first));
+        });
+        glm::vec2 range = chunkRanges[0];
+        for (const glm::vec2& chunkRange : chunkRanges)
+            range = glm::vec2(std::min(range.x, chunkRange.x), std::max(range.y, chunkRange.y));
+
+        // Scores outside the finite range (and NaN) land in the first or last bin, which keeps the bins ordered like the scores.
+        double binScale = range.y > range.x ? (numBins - 1) / (static_cast<double>(range.y) - range.x) : 0.0;
+        auto getBin = [&](float score)
+        {
+            double bin = (static_cast<double>(score) - range.x) * binScale;
+            return bin >= numBins - 1 ? numBins - 1 : bin > 0.0 ? static_cast<size_t>(bin) : size_t(0);
+        };
+        std::vector<std::vector<size_t>> chunkHistograms(numChunks, std::vector<size_t>(numBins, 0));
+        forEachChunk([&](size_t chunk, size_t first, size_t end)
+        {
+            for (size_t i = first; i < end; ++i)
+                ++chunkHistograms[chunk][getBin(scores[i].first)];
+        });
+
+        size_t pivotBin = 0;
+        size_t numBelow = 0;
+        size_t numPivot = 0;
+        for (;; ++pivotBin)
+        {
+            numPivot = 0;
+            for (const std::vector<size_t>& histogram : chunkHistograms)
+                numPivot += histogram[pivotBin];
+            if (numBelow + numPivot > count)
+                break;
+            numBelow += numPivot;
+        }
+
+        // Each chunk writes its scores below, in and above the pivot bin to its own slice of the three output regions.
+        std::vector<std::array<size_t, 3>> chunkOffsets(numChunks);
+        std::array<size_t, 3> regionOffset = { 0, numBelow, numBelow + numPivot };
+        for (size_t chunk = 0; chunk < numChunks; ++chunk)
+        {
+            const std::vector<size_t>& histogram = chunkHistograms[chunk];
+            std::array<size_t, 3> chunkCounts = { std::accumulate(histogram.begin(), histogram.begin() + pivotBin, size_t(0)), histogram[pivotBin], 0 };
+            chunkCounts[2] = std::accumulate(histogram.begin() + pivotBin + 1, histogram.end(), size_t(0));
+            for (size_t region = 0; region < 3; ++region)
+            {
+                chunkOffsets[chunk][region] = regionOffset[region];
+                regionOffset[region] += chunkCounts[region];
+            }
+        }
+
+        std::vector<std::pair<float, uint32_t>> partitioned(scores.size());
+        forEachChunk([&](size_t chunk, size_t first, size_t end)
+        {
+            std::array<size_t, 3> offsets = chunkOffsets[chunk];
+            for (size_t i = first; i < end; ++i)
+            {
+                size_t bin = getBin(scores[i].first);
+                partitioned[offsets[bin < pivotBin ? 0 : bin == pivotBin ? 1 : 2]++] = scores[i];
+            }
+        });
+        std::nth_element(partitioned.begin() + numBelow, partitioned.begin() + count, partitioned.begin() + numBelow + numPivot);
+        scores.swap(partitioned);
+    }
 }
 
 namespace VCT
@@ -76,11 +425,16 @@ namespace VCT
         : m_Initialized(false)
         , m_NumberOfSurfacePoints(0)
         , m_IePrimitiveCount(0)
+        , m_IeClusterCount(0)
         , m_SubIePrimitiveCount(0)
         , m_SceneAABB({})
         , m_Params({})
         , m_VoxelDimensions(glm::vec3(0))
+        , m_RouteTableSize(0)
         , m_VCTData({})
+        , m_NumBeamPrunedRays(0)
+        , m_BeamScoreFunction([](const BeamCandidate& candidate) { return candidate.timeDelay; })
+        , m_CaptureFrontierRays(false)
         , m_ActiveRecvBufferIndex(0)
         , m_UseLabelHashing(false)
         , m_RefinedPathStorage(1)
@@ -92,6 +446,7 @@ namespace VCT
         , m_IeCount(0)
         , m_TransmitStatus(VCT::Status::ProcessingRequired)
         , m_VoxelTexture(0)
+        , m_VoxelOctantTexture(0)
     {
 
     }
@@ -117,6 +472,12 @@ namespace VCT
             CalculateDiffractionRays();
             CalculateVoxelDimensions();
             LinkPointNodes();
+            if (m_Params.useDirectionalSkipDistances)
+                CalculateDirectionalSkipDistances();
+            if (m_Params.maxTimeDelay > 0.0f)
+                CalculateReceiverDistances();
+            if (m_Params.maxPathLoss > 0.0f)
+                CalculateReflectionLosses();
             UploadBuffers();
             m_Initialized = true;
         }
@@ -135,7 +496,9 @@ namespace VCT
             m_VCTDataBuffer = DeviceBuffer(sizeof(VCTData));
             m_VCTDataBuffer.Upload(&m_VCTData, 1);
             m_TransferHostBuffer = std::make_unique<TraceData[]>(m_Params.receivedPathBufferSize);
-            m_CoarsePathStorage = PathStorage(m_Params.numOfCoarsePathsPerUniqueRoute);
+            m_CoarsePathStorage = PathStorage(m_Params.numOfCoarsePathsPerUniqueRoute, static_cast<size_t>(m_Params.coarsePathMemoryLimitMB) << 20, m_Params.pathSpillDirectory);
+            if (m_Params.labelVisibilitySamples > 0)
+                BuildLabelVisibility();
         }
         return m_Initialized;
     }
@@ -172,6 +535,21 @@ namespace VCT
         params.useLabelHashing = true;
         params.useConeReflections = true;
         params.numOfCoarsePathsPerUniqueRoute = inputData.sceneSettings.numCoarsePathsPerUniqueRoute;
+        params.useDirectionalSkipDistances = inputData.sceneSettings.useDirectionalSkipDistances;
+        params.deterministicEmission = inputData.sceneSettings.deterministicEmission;
+        params.beamWidth = inputData.sceneSettings.beamWidth;
+        params.rayMergeLimit = inputData.sceneSettings.rayMergeLimit;
+        params.rayMergeDirectionResolution = inputData.sceneSettings.rayMergeDirectionResolution;
+        params.maxTimeDelay = inputData.sceneSettings.maxTimeDelay;
+        params.frequency = inputData.sceneSettings.frequency;
+        params.maxPathLoss = inputData.sceneSettings.maxPathLoss;
+        params.materials = inputData.materials;
+        params.bidirectionalSearch = inputData.sceneSettings.bidirectionalSearch;
+        params.labelVisibilitySamples = inputData.sceneSettings.labelVisibilitySamples;
+        params.diffractionReceiverCulling = inputData.sceneSettings.diffractionReceiverCulling;
+        params.edgeSegmentMergeCount = inputData.sceneSettings.edgeSegmentMergeCount;
+        params.coarsePathMemoryLimitMB = inputData.sceneSettings.coarsePathMemoryLimitMB;
+        params.pathSpillDirectory = inputData.sceneSettings.pathSpillDirectory;
 
         params.refineParams.numIterations = inputData.sceneSettings.numIterations;
         params.refineParams.delta = inputData.sceneSettings.delta;
@@ -200,46 +578,234 @@ namespace VCT
             return;
         }
 
+        if (m_Params.bidirectionalSearch && m_Params.maximumNumberOfInteractions >= 2)
+        {
+            TraceBidirectional();
+            return;
+        }
+
         for (uint32_t transmitterID = 0; transmitterID < static_cast<uint32_t>(m_Params.transmitters.size()); ++transmitterID)
             TraceTransmitter(transmitterID);
     }
 
+    void VoxelConeTracer::TraceBidirectional()
+    {
+        PROFILE_SCOPE();
+        uint32_t numInteractions = m_Params.maximumNumberOfInteractions;
+        uint32_t numTransmitters = static_cast<uint32_t>(m_Params.transmitters.size());
+        uint32_t forwardLimit = (numInteractions + 1) / 2;
+        uint32_t backwardLimit = numInteractions / 2 + 1;
+
+        // The receiver distance field bounds the distance to a receiver, which is not where backward rays end.
+        const float* receiverDistances = m_VCTData.coneTracingData.delayBound.receiverDistances;
+        m_VCTData.coneTracingData.delayBound.receiverDistances = nullptr;
+        m_VCTData.coneTracingData.maximumNumberOfInteractions = backwardLimit;
+        m_CaptureFrontierRays = true;
+        // Neither half ends on a receiver at its own limit, the last rays continue through the frontier join.
+        m_VCTData.coneTracingData.diffractionReceiverCulling = false;
+
+        std::vector<Frontier> backwardFrontiers(m_Params.receivers.size());
+        for (uint32_t rxID = 0; rxID < static_cast<uint32_t>(m_Params.receivers.size()); ++rxID)
+        {
+            TraceTransmitter(numTransmitters + rxID);
+            Frontier& frontier = backwardFrontiers[rxID];
+            frontier.rays.swap(m_FrontierRays);
+            uint32_t numDuplicates = RemoveDuplicateFrontierRays(frontier.rays);
+            for (uint32_t rayIndex = 0; rayIndex < static_cast<uint32_t>(frontier.rays.size()); ++rayIndex)
+            {
+                const TraceData& traceData = frontier.rays[rayIndex].traceData;
+                frontier.rayIndicesByIe[traceData.interactions[traceData.numInteractions - 1].ieID].push_back(rayIndex);
+            }
+            LOG("Backward frontier for RX %u: %zu rays, %u duplicate routes removed", rxID, frontier.rays.size(), numDuplicates);
+        }
+
+        m_VCTData.coneTracingData.delayBound.receiverDistances = receiverDistances;
+        m_VCTData.coneTracingData.maximumNumberOfInteractions = forwardLimit;
+        for (uint32_t transmitterID = 0; transmitterID < numTransmitters; ++transmitterID)
+        {
+            TraceTransmitter(transmitterID);
+            if (m_TransferStatus.valid())
+                m_TransferStatus.wait();
+
+            uint32_t numDuplicates = RemoveDuplicateFrontierRays(m_FrontierRays);
+            LOG("Forward frontier for TX %u: %zu rays, %u duplicate routes removed", transmitterID, m_FrontierRays.size(), numDuplicates);
+            JoinFrontierRays(transmitterID, m_FrontierRays, backwardFrontiers);
+            m_FrontierRays.clear();
+        }
+
+        m_CaptureFrontierRays = false;
+        m_VCTData.coneTracingData.diffractionReceiverCulling = m_Params.diffractionReceiverCulling;
+        m_VCTData.coneTracingData.maximumNumberOfInteractions = numInteractions;
+        m_VCTDataBuffer.Upload(&m_VCTData, 1);
+    }
+
+    void VoxelConeTracer::CaptureFrontierRays(uint32_t numPaths)
+    {
+        std::vector<PropagationData> propPaths(numPaths);
+        m_PropPathBuffers[m_DepthLevel].Download(propPaths.data(), numPaths);
+        for (const PropagationData& propPath : propPaths)
+        {
+            if (!propPath.voxelTraceData.finished)
+                m_FrontierRays.push_back(propPath.tpData);
+        }
+    }
+
+    void VoxelConeTracer::JoinFrontierRays(uint32_t transmitterID, const std::vector<TraceProcessingData>& forwardRays, const std::vector<Frontier>& backwardFrontiers)
+    {
+        PROFILE_SCOPE();
+        uint32_t forwardLimit = (m_Params.maximumNumberOfInteractions + 1) / 2;
+        const glm::vec3& txPosition = m_Params.transmitters[transmitterID].position;
+        uint64_t numMatches = 0;
+        uint32_t numJoined = 0;
+        std::vector<TraceData> joinedPaths;
+        for (uint32_t rxID = 0; rxID < static_cast<uint32_t>(backwardFrontiers.size()); ++rxID)
+        {
+            const Frontier& frontier = backwardFrontiers[rxID];
+            const glm::vec3& rxPosition = m_Params.receivers[rxID].position;
+            joinedPaths.clear();
+            for (const TraceProcessingData& forwardRay : forwardRays)
+            {
+                const TraceData& forward = forwardRay.traceData;
+                auto it = frontier.rayIndicesByIe.find(forward.interactions[forward.numInteractions - 1].ieID);
+                if (it == frontier.rayIndicesByIe.end())
+                    continue;
+
+                for (uint32_t rayIndex : it->second)
+                {
+                    const TraceProcessingData& backwardRay = frontier.rays[rayIndex];
+                    const TraceData& backward = backwardRay.traceData;
+                    uint32_t numJoinedInteractions = forward.numInteractions + backward.numInteractions - 1;
+                    bool sharedDiffraction = forward.interactions[forward.numInteractions - 1].type == InteractionType::Diffraction;
+                    ++numMatches;
+                    if (numJoinedInteractions <= forwardLimit || numJoinedInteractions > m_Params.maximumNumberOfInteractions ||
+                        forwardRay.numDiffractions + backwardRay.numDiffractions - sharedDiffraction > m_Params.maximumNumberOfDiffractions ||
+                        !IsConsistentJoin(forward, backward, txPosition, rxPosition))
+                        continue;
+
+                    TraceData& path = joinedPaths.emplace_back(forward);
+                    path.receiverID = rxID;
+                    for (int32_t i = static_cast<int32_t>(backward.numInteractions) - 2; i >= 0; --i)
+                        path.interactions[path.numInteractions++] = backward.interactions[i];
+
+                    float pathLength = 0.0f;
+                    glm::vec3 previous = txPosition;
+                    for (uint32_t i = 0; i < path.numInteractions; ++i)
+                    {
+                        pathLength += glm::length(path.interactions[i].position - previous);
+                        previous = path.interactions[i].position;
+                    }
+                    path.timeDelay = (pathLength + glm::length(rxPosition - previous)) * Constants::InvLightSpeedInVacuum;
+                    if (m_Params.maxTimeDelay > 0.0f && path.timeDelay > m_Params.maxTimeDelay)
+                        joinedPaths.pop_back();
+                }
+            }
+            numJoined += static_cast<uint32_t>(joinedPaths.size());
+            if (joinedPaths.size())
+                m_CoarsePathStorage.AddPaths(joinedPaths, m_UseLabelHashing);
+        }
+        LOG("Bidirectional join for TX %u: %zu forward rays, %llu shared IE matches, %u joined paths", transmitterID, forwardRays.size(), static_cast<unsigned long long>(numMatches), numJoined);
+    }
+
+    bool VoxelConeTracer::IsConsistentJoin(const TraceData& forward, const TraceData& backward, const glm::vec3& txPosition, const glm::vec3& rxPosition) const
+    {
+        const Interaction& shared = forward.interactions[forward.numInteractions - 1];
+        const Interaction& mirrored = backward.interactions[backward.numInteractions - 1];
+        glm::vec3 incident = shared.position - (forward.numInteractions > 1 ? forward.interactions[forward.numInteractions - 2].position : txPosition);
+        glm::vec3 outgoing = (backward.numInteractions > 1 ? backward.interactions[backward.numInteractions - 2].position : rxPosition) - mirrored.position;
+        float incidentLength = glm::length(incident);
+        float outgoingLength = glm::length(outgoing);
+        if (incidentLength <= 0.0f || outgoingLength <= 0.0f)
+            return false;
+
+        incident /= incidentLength;
+        outgoing /= outgoingLength;
+
+        // Both halves were traced with cones and IE positions are only known up to an IE voxel.
+        float tolerance = 2.0f * m_MaxDiffuseAngle + glm::asin(glm::min(GetIeVoxelSize() / glm::min(incidentLength, outgoingLength), 1.0f));
+        if (shared.type == InteractionType::Reflection)
+            return glm::dot(glm::reflect(incident, shared.normal), outgoing) >= glm::cos(tolerance);
+
+        const glm::vec3& edgeDirection = m_DiffractionEdges[shared.label].forward;
+        return glm::abs(glm::dot(incident, edgeDirection) - glm::dot(outgoing, edgeDirection)) <= glm::sin(tolerance);
+    }
+
     void VoxelConeTracer::Refine(uint32_t txID, uint32_t rxID)
     {
         {
             PROFILE_SCOPE();
-            const std::vector<TraceData>* paths = m_CoarsePathStorage.GetPaths(txID, rxID);
-            if (!paths)
+            uint32_t numPaths = m_CoarsePathStorage.GetNumPaths(txID, rxID);
+            if (!numPaths)
             {
                 LOG("No paths to refine.");
                 return;
             }
-            DeviceBuffer pathsToRefineBuffer = DeviceBuffer::Create(*paths);
-            DeviceBuffer refinedPathsBuffer = DeviceBuffer(sizeof(TraceData) * paths->size());
-            DeviceBuffer numRefinedPathsBuffer = DeviceBuffer(sizeof(uint32_t));
-            numRefinedPathsBuffer.MemsetZero();
-
-            m_VCTData.pathsToRefine = pathsToRefineBuffer.DevicePointerCast<TraceData>();
-            m_VCTData.refinedPaths = refinedPathsBuffer.DevicePointerCast<TraceData>();
-            m_VCTData.numRefinedPaths = numRefinedPathsBuffer.DevicePointerCast<uint32_t>();
-
-            m_VCTDataBuffer.Upload(&m_VCTData, 1);
-            KernelData::Get().GetRefinePipeline().LaunchAndSynchronize(m_VCTDataBuffer, glm::uvec3(paths->size(), 1, 1));
+            // Paths are refined in blocks so links whose coarse paths were spilled to disk are streamed rather than loaded at once.
             uint32_t numRefined = 0;
-            numRefinedPathsBuffer.Download(&numRefined, 1);
+            if (!m_CoarsePathStorage.ReadPaths(txID, rxID, m_Params.propagationPathBufferSize, [&](const PackedPaths& paths) { numRefined += RefineBlock(paths); }))
+                LOG("Some spilled coarse paths could not be read back and were not refined.");
             LOG("Number of refined paths that converged: %u", numRefined);
-            if (numRefined)
-            {
-                std::vector<TraceData> refinedPaths(numRefined);
-                refinedPathsBuffer.Download(refinedPaths.data(), refinedPaths.size());
-                m_RefinedPathStorage.AddPaths(refinedPaths, m_UseLabelHashing);
-            }
-            else
+            if (!numRefined)
                 return;
         }
         PostProcess(txID, rxID);        
     }
 
+    void VoxelConeTracer::RefineAll()
+    {
+        PROFILE_SCOPE();
+        // Coarse paths of all links are concatenated into full blocks. Refined paths carry their transmitter and receiver IDs,
+        // so adding them to the refined storage scatters them back to their links. Paths of an earlier call are dropped first.
+        m_RefinedPathStorage.Clear();
+        uint32_t numBlocks = 0;
+        uint32_t numRefined = 0;
+        bool readAll = m_CoarsePathStorage.ReadAllPaths(m_Params.propagationPathBufferSize, [&](const PackedPaths& paths)
+        {
+            numRefined += RefineBlock(paths);
+            ++numBlocks;
+        });
+        if (!readAll)
+            LOG("Some spilled coarse paths could not be read back and were not refined.");
+        LOG("Number of refined paths that converged: %u in %u launches", numRefined, numBlocks);
+        if (numRefined)
+            m_RefinedPathStorage.TryRemoveDuplicates(m_Params.transmitters, m_Params.receivers, m_Channel.waveLength);
+    }
+
+    uint32_t VoxelConeTracer::RefineBlock(const PackedPaths& paths)
+    {
+        // Refine buffers are kept between blocks and links and only grow, instead of being allocated for every link.
+        const std::vector<PackedInteraction>& interactions = paths.GetInteractions();
+        if (sizeof(PackedPathHeader) * paths.Size() > m_PathsToRefineBuffer.GetSize())
+        {
+            m_PathsToRefineBuffer = DeviceBuffer(sizeof(PackedPathHeader) * paths.Size());
+            m_RefinedPathsBuffer = DeviceBuffer(sizeof(TraceData) * paths.Size());
+        }
+        if (sizeof(PackedInteraction) * interactions.size() > m_PathInteractionsToRefineBuffer.GetSize())
+            m_PathInteractionsToRefineBuffer = DeviceBuffer(sizeof(PackedInteraction) * interactions.size());
+        if (!m_NumRefinedPathsBuffer.GetSize())
+            m_NumRefinedPathsBuffer = DeviceBuffer(sizeof(uint32_t));
+
+        m_VCTData.pathsToRefine = m_PathsToRefineBuffer.DevicePointerCast<PackedPathHeader>();
+        m_VCTData.pathInteractionsToRefine = m_PathInteractionsToRefineBuffer.DevicePointerCast<PackedInteraction>();
+        m_VCTData.refinedPaths = m_RefinedPathsBuffer.DevicePointerCast<TraceData>();
+        m_VCTData.numRefinedPaths = m_NumRefinedPathsBuffer.DevicePointerCast<uint32_t>();
+        m_VCTDataBuffer.Upload(&m_VCTData, 1);
+        m_PathsToRefineBuffer.Upload(paths.GetHeaders().data(), paths.Size());
+        if (!interactions.empty())
+            m_PathInteractionsToRefineBuffer.Upload(interactions.data(), interactions.size());
+        m_NumRefinedPathsBuffer.MemsetZero();
+        KernelData::Get().GetRefinePipeline().LaunchAndSynchronize(m_VCTDataBuffer, glm::uvec3(paths.Size(), 1, 1));
+
+        uint32_t numRefined = 0;
+        m_NumRefinedPathsBuffer.Download(&numRefined, 1);
+        if (numRefined)
+        {
+            std::vector<TraceData> refinedPaths(numRefined);
+            m_RefinedPathsBuffer.Download(refinedPaths.data(), refinedPaths.size());
+            m_RefinedPathStorage.AddPaths(refinedPaths, m_UseLabelHashing);
+        }
+        return numRefined;
+    }
+
     bool VoxelConeTracer::LoadPointCloud(const PointData* points, size_t numPoints, const std::vector<Edge>& edges)
     {
         m_UseLabelHashing = true;
@@ -248,8 +814,8 @@ namespace VCT
         m_SceneAABB.min = reinterpret_cast<const glm::vec3&>(points->position.x);
         m_SceneAABB.max = reinterpret_cast<const glm::vec3&>(points->position.x);
         LoadSurfacePoints(points, numPoints);
-        LoadEdgePoints();
         LoadReceiverPoints();
+        LoadEdgePoints();
         return true;
     }
 
@@ -310,7 +876,6 @@ namespace VCT
                 node.materialID = point.material;
                 node.type = IEType::Surface;
                 node.ieNext = Constants::InvalidPointIndex;
-                node.materialID = 1;
                 m_PointNodes.push_back(node);
 
                 m_SceneAABB.min = glm::min(m_SceneAABB.min, point.position);
@@ -327,6 +892,29 @@ namespace VCT
         glm::vec3 voxelWorldOrigin = m_SceneAABB.min;
         float invVoxelSize = 1.0f / m_Params.voxelSize;
         float invIeVoxelSize = 1.0f / ieVoxelSize;
+        float ieBoundingSphereRadius = glm::length(glm::vec3(1.0f / m_Params.ieVoxelAxisSizeFactor));
+        uint32_t mergeCount = glm::max(m_Params.edgeSegmentMergeCount, 1u);
+
+        auto addSegment = [&](const glm::vec3& startPoint, const glm::vec3& endPoint, uint32_t parentID)
+        {
+            uint32_t segmentID = static_cast<uint32_t>(m_DiffractionEdgeSegments.size());
+            DiffractionEdgeSegment segment{};
+            segment.startPoint = startPoint;
+            segment.endPoint = endPoint;
+            segment.startPointVoxelSpace = Utils::WorldToVoxel(segment.startPoint, voxelWorldOrigin, invVoxelSize);
+            segment.endPointVoxelSpace = Utils::WorldToVoxel(segment.endPoint, voxelWorldOrigin, invVoxelSize);
+            segment.boundingRadius = glm::max(ieBoundingSphereRadius, (glm::distance(segment.startPointVoxelSpace, segment.endPointVoxelSpace) + ieBoundingSphereRadius) * 0.5f);
+            segment.parentID = parentID;
+            m_DiffractionEdgeSegments.push_back(segment);
+
+            PointNode node{};
+            node.position = (segment.startPoint + segment.endPoint) / 2.0f;
+            node.type = IEType::Edge;
+            node.ieNext = Constants::InvalidPointIndex;
+            node.edgeSegmentID = segmentID;
+            node.label = parentID;
+            m_PointNodes.push_back(node);
+        };
 
         uint32_t parentID = 0;
         for (const DiffractionEdge& edge : m_DiffractionEdges)
@@ -334,9 +922,11 @@ namespace VCT
             float edgeLengthSq = Utils::DistanceSquared(edge.startPoint, edge.endPoint);
             VoxelTraverser traverser = VoxelTraverser(Utils::WorldToVoxel(edge.startPoint, voxelWorldOrigin, invIeVoxelSize), edge.forward);
             glm::vec3 previousPosition = edge.startPoint;
+            glm::vec3 segmentStart = edge.startPoint;
+            glm::ivec3 segmentVoxel = glm::ivec3(0);
+            uint32_t numMergedSteps = 0;
             
             bool edgeProcessingFinished = false;
-            uint32_t nSegments = 0;
             while (!edgeProcessingFinished)
             {
                 traverser.Step(0);
@@ -347,29 +937,23 @@ namespace VCT
                     worldPosition = edge.endPoint;
                     edgeProcessingFinished = true;
                 }
-                
-                uint32_t segmentID = static_cast<uint32_t>(m_DiffractionEdgeSegments.size());
-                DiffractionEdgeSegment segment{};
-                segment.startPoint = previousPosition;
-                segment.endPoint = worldPosition;
-                segment.startPointVoxelSpace = Utils::WorldToVoxel(segment.startPoint, voxelWorldOrigin, invVoxelSize);
-                segment.endPointVoxelSpace = Utils::WorldToVoxel(segment.endPoint, voxelWorldOrigin, invVoxelSize);
-                segment.parentID = parentID;
-                m_DiffractionEdgeSegments.push_back(segment);
 
-                PointNode node{};
-                node.position = (segment.startPoint + segment.endPoint) / 2.0f;
-                node.type = IEType::Edge;
-                node.ieNext = Constants::InvalidPointIndex;
-                node.edgeSegmentID = segmentID;
-                node.label = parentID;
-                m_PointNodes.push_back(node);
-                
+                // Steps are merged while they stay inside one coarse voxel, so the merged node is found in the voxel the whole segment lies in.
+                glm::ivec3 stepVoxel = glm::ivec3(glm::floor(Utils::WorldToVoxel((previousPosition + worldPosition) / 2.0f, voxelWorldOrigin, invVoxelSize)));
+                if (numMergedSteps > 0 && (numMergedSteps == mergeCount || stepVoxel != segmentVoxel))
+                {
+                    addSegment(segmentStart, previousPosition, parentID);
+                    segmentStart = previousPosition;
+                    numMergedSteps = 0;
+                }
+                segmentVoxel = stepVoxel;
+                ++numMergedSteps;
                 previousPosition = worldPosition;
             }
+            addSegment(segmentStart, previousPosition, parentID);
             parentID++;
         }
-        LOG("Number of edge segments: %u", m_DiffractionEdgeSegments.size());
+        LOG("Number of edge segments: %zu for %zu edges, merge count %u", m_DiffractionEdgeSegments.size(), m_DiffractionEdges.size(), mergeCount);
     }
 
     void VoxelConeTracer::LoadReceiverPoints()
@@ -406,7 +990,7 @@ namespace VCT
         m_IeVoxelNodeIndices.resize(GetIeVoxelCount(), { Constants::InvalidPointIndex, 0 });
         m_PerIeSubIePrimitiveCount.resize(GetIeVoxelCount(), 0);
         std::vector<bool> refinePrimitiveCount(GetSubIeVoxelCount(), false);
-        m_VoxelTextureData.resize(GetVoxelCount(), { Constants::InvalidPointIndex, Constants::InvalidPointIndex });
+        m_VoxelFieldData.resize(GetVoxelCount(), 0);
         m_VoxelPointData.resize(GetVoxelCount(), {});
 
         LOG("Number of point nodes : %u, SurfacePoints: %u", m_PointNodes.size(), m_NumberOfSurfacePoints);
@@ -414,7 +998,7 @@ namespace VCT
         {
             PointNode& pointNode = m_PointNodes[pointIndex];
             uint32_t voxelID = Utils::WorldToVoxelID(pointNode.position, voxelWorldOrigin, m_Params.voxelSize, m_VoxelDimensions);
-            m_VoxelTextureData[voxelID].x = voxelID;
+            m_VoxelFieldData[voxelID] = Constants::VoxelOccupiedBit;
             VoxelPointData& vpData = m_VoxelPointData[voxelID];
             uint32_t ieVoxelID = Utils::WorldToVoxelID(pointNode.position, voxelWorldOrigin, ieVoxelSize, ieVoxelDimensions);
             uint32_t refineVoxelID = Utils::WorldToVoxelID(pointNode.position, voxelWorldOrigin, ieVoxelSize / m_Params.subIeVoxelAxisSizeFactor, ieVoxelDimensions * m_Params.subIeVoxelAxisSizeFactor);
@@ -429,6 +1013,10 @@ namespace VCT
                 {
                     ++m_IePrimitiveCount;
                     ++vpData.numPrimitives;
+                    glm::uvec3 localIeVoxel = Utils::VoxelIDToCoord(ieVoxelID, ieVoxelDimensions) % m_Params.ieVoxelAxisSizeFactor;
+                    uint32_t octantBit = 1u << Utils::GetIeVoxelOctant(localIeVoxel, m_Params.ieVoxelAxisSizeFactor);
+                    m_IeClusterCount += (vpData.surfaceOctantMask & octantBit) == 0;
+                    vpData.surfaceOctantMask |= octantBit;
                 }
                 if (!refinePrimitiveCount[refineVoxelID])
                 {
@@ -456,12 +1044,146 @@ namespace VCT
         }
     }
 
+    void VoxelConeTracer::CalculateDirectionalSkipDistances()
+    {
+        PROFILE_SCOPE();
+        constexpr uint32_t numOctants = 8;
+        glm::ivec3 dimensions = glm::ivec3(m_VoxelDimensions);
+        std::array<std::vector<uint8_t>, numOctants> octantDistances;
+
+        auto calculateOctant = [&](uint32_t octant)
+        {
+            glm::ivec3 stepDirection = glm::ivec3(octant & 1u, (octant >> 1) & 1u, (octant >> 2) & 1u) * 2 - 1;
+            std::vector<uint8_t> forwardDistances(GetVoxelCount());
+            auto getForwardDistance = [&](const glm::ivec3& coord) -> uint32_t
+            {
+                bool inside = glm::all(glm::greaterThanEqual(coord, glm::ivec3(0))) && glm::all(glm::lessThan(coord, dimensions));
+                return inside ? forwardDistances[Utils::VoxelCoordToID(glm::uvec3(coord), m_VoxelDimensions)] : Constants::MaximumDirectionalSkipDistance;
+            };
+            auto toCoord = [&](const glm::ivec3& iteration)
+            {
+                return glm::ivec3(stepDirection.x > 0 ? dimensions.x - 1 - iteration.x : iteration.x,
+                                  stepDirection.y > 0 ? dimensions.y - 1 - iteration.y : iteration.y,
+                                  stepDirection.z > 0 ? dimensions.z - 1 - iteration.z : iteration.z);
+            };
+
+            for (int32_t z = 0; z < dimensions.z; ++z)
+                for (int32_t y = 0; y < dimensions.y; ++y)
+                    for (int32_t x = 0; x < dimensions.x; ++x)
+                    {
+                        glm::ivec3 coord = toCoord(glm::ivec3(x, y, z));
+                        uint32_t voxelID = Utils::VoxelCoordToID(glm::uvec3(coord), m_VoxelDimensions);
+                        uint32_t distance = 0;
+                        if (!(m_VoxelFieldData[voxelID] & Constants::VoxelOccupiedBit))
+                        {
+                            distance = Constants::MaximumDirectionalSkipDistance;
+                            for (uint32_t e = 1; e < numOctants; ++e)
+                                distance = glm::min(distance, getForwardDistance(coord + stepDirection * glm::ivec3(e & 1u, (e >> 1) & 1u, (e >> 2) & 1u)) + 1);
+                        }
+                        forwardDistances[voxelID] = static_cast<uint8_t>(distance);
+                    }
+
+            std::vector<uint8_t>& distances = octantDistances[octant];
+            distances.resize(GetVoxelCount());
+            for (uint32_t voxelID = 0; voxelID < GetVoxelCount(); ++voxelID)
+            {
+                glm::ivec3 coord = glm::ivec3(Utils::VoxelIDToCoord(voxelID, m_VoxelDimensions));
+                int32_t distance = forwardDistances[voxelID];
+                for (uint32_t e = 1; e < numOctants; ++e)
+                    distance = glm::min(distance, static_cast<int32_t>(getForwardDistance(coord - stepDirection * glm::ivec3(e & 1u, (e >> 1) & 1u, (e >> 2) & 1u))) - 1);
+
+                distances[voxelID] = static_cast<uint8_t>(glm::max(distance, 1));
+            }
+        };
+
+        std::vector<std::future<void>> tasks;
+        for (uint32_t octant = 0; octant < numOctants; ++octant)
+            tasks.push_back(std::async(std::launch::async, calculateOctant, octant));
+
+        for (auto& task : tasks)
+            task.wait();
+
+        uint64_t totalDistance = 0;
+        m_VoxelOctantData.resize(GetVoxelCount(), { 0, 0 });
+        for (uint32_t voxelID = 0; voxelID < GetVoxelCount(); ++voxelID)
+        {
+            uint2& packedDistances = m_VoxelOctantData[voxelID];
+            for (uint32_t octant = 0; octant < numOctants; ++octant)
+            {
+                uint32_t distance = octantDistances[octant][voxelID];
+                (octant < 4 ? packedDistances.x : packedDistances.y) |= distance << ((octant & 3u) * 8u);
+                totalDistance += distance;
+            }
+        }
+        LOG("Average directional skip distance: %f", static_cast<double>(totalDistance) / (static_cast<double>(GetVoxelCount()) * numOctants));
+    }
+
+    void VoxelConeTracer::CalculateReceiverDistances()
+    {
+        PROFILE_SCOPE();
+        ReceiverGrid receiverGrid(m_Params.receivers);
+        m_ReceiverDistances.resize(GetVoxelCount());
+
+        std::vector<std::future<void>> tasks;
+        for (uint32_t z = 0; z < m_VoxelDimensions.z; ++z)
+        {
+            tasks.push_back(std::async(std::launch::async, [&, z]()
+            {
+                for (uint32_t y = 0; y < m_VoxelDimensions.y; ++y)
+                    for (uint32_t x = 0; x < m_VoxelDimensions.x; ++x)
+                    {
+                        glm::uvec3 coord = glm::uvec3(x, y, z);
+                        glm::vec3 center = Utils::VoxelToWorld(coord, m_SceneAABB.min, m_Params.voxelSize, m_Params.voxelSize * 0.5f);
+                        m_ReceiverDistances[Utils::VoxelCoordToID(coord, m_VoxelDimensions)] = receiverGrid.GetNearestDistance(center);
+                    }
+            }));
+        }
+        for (auto& task : tasks)
+            task.get();
+    }
+
+    void VoxelConeTracer::CalculateReflectionLosses()
+    {
+        PROFILE_SCOPE();
+        constexpr uint32_t binCount = Constants::ReflectionLossBinCount;
+        double frequencyGHz = m_Params.frequency * 1e-9;
+        m_ReflectionLosses.resize(m_Params.materials.size() * binCount);
+        for (size_t materialID = 0; materialID < m_Params.materials.size(); ++materialID)
+        {
+            for (uint32_t bin = 0; bin < binCount; ++bin)
+            {
+                // Widen each bin by its neighbours as the cone ray only approximates the final incident angle.
+                double cosFirst = static_cast<double>(bin > 0 ? bin - 1 : 0) / binCount;
+                double cosLast = static_cast<double>(glm::min(bin + 2, binCount)) / binCount;
+                double reflectance = std::max(CalculateReflectance(m_Params.materials[materialID], frequencyGHz, cosFirst),
+                                              CalculateReflectance(m_Params.materials[materialID], frequencyGHz, cosLast));
+                m_ReflectionLosses[materialID * binCount + bin] = static_cast<float>(-10.0 * std::log10(std::clamp(reflectance, 1e-12, 1.0)));
+            }
+            LOG("Material %zu: reflection loss %.2f dB near normal incidence", materialID, m_ReflectionLosses[materialID * binCount + binCount - 1]);
+        }
+    }
+
     void VoxelConeTracer::UploadBuffers()
     {
         m_PointNodeBuffer = DeviceBuffer::Create(m_PointNodes);
 
         m_IeVoxelPointNodeIndicesBuffer = DeviceBuffer::Create(m_IeVoxelNodeIndices);
-        m_VoxelTextureDataBuffer = DeviceBuffer::Create(m_VoxelTextureData);
+        m_VoxelFieldDataBuffer = DeviceBuffer::Create(m_VoxelFieldData);
+        LOG("Voxel field memory: %zu bytes", m_VoxelFieldData.size() * sizeof(uint8_t));
+        if (m_Params.useDirectionalSkipDistances)
+            m_VoxelOctantDataBuffer = DeviceBuffer::Create(m_VoxelOctantData);
+        if (m_Params.maxTimeDelay > 0.0f)
+        {
+            m_ReceiverDistanceBuffer = DeviceBuffer::Create(m_ReceiverDistances);
+            m_NumDelayPrunedRaysBuffer = DeviceBuffer(sizeof(uint32_t));
+        }
+        if (m_Params.maxPathLoss > 0.0f)
+        {
+            if (!m_ReflectionLosses.empty())
+                m_ReflectionLossBuffer = DeviceBuffer::Create(m_ReflectionLosses);
+            m_NumPathLossPrunedRaysBuffer = DeviceBuffer(sizeof(uint32_t));
+        }
+        m_DiffractionStatisticsBuffer = DeviceBuffer(sizeof(DiffractionStatistics));
 
         VoxelizationData data{};
         glm::vec3 voxelWorldOrigin = m_SceneAABB.min;
@@ -470,7 +1192,7 @@ namespace VCT
         data.pointNodes = m_PointNodeBuffer.DevicePointerCast<PointNode>();
         data.ieVoxelPointNodeIndices = m_IeVoxelPointNodeIndicesBuffer.DevicePointerCast<uint2>();
 
-        data.voxelTextureData = m_VoxelTextureDataBuffer.DevicePointerCast<uint2>();
+        data.voxelFieldData = m_VoxelFieldDataBuffer.DevicePointerCast<uint8_t>();
         data.ieVoxelWorldInfo = VoxelWorldInfo(m_SceneAABB.min, GetIeVoxelSize(), GetIeVoxelDimensions());
 
         m_VoxelInfoBuffer = DeviceBuffer(sizeof(VoxelInfo) * GetVoxelCount());
@@ -488,6 +1210,9 @@ namespace VCT
         m_IePointCountBuffer.MemsetZero();
         m_IePrimitiveCountBuffer = DeviceBuffer(sizeof(uint32_t));
         m_IePrimitiveCountBuffer.MemsetZero();
+        m_IeClusterBuffer = DeviceBuffer(m_IeClusterCount * sizeof(IECluster));
+        m_IeClusterCountBuffer = DeviceBuffer(sizeof(uint32_t));
+        m_IeClusterCountBuffer.MemsetZero();
 
         data.iePrimitivePoints = m_IePointBuffer.DevicePointerCast<PrimitivePoint>();
         data.iePrimitives = m_IePrimitiveBuffer.DevicePointerCast<OptixAabb>();
@@ -496,6 +1221,8 @@ namespace VCT
         data.iePointCount = m_IePointCountBuffer.DevicePointerCast<uint32_t>();
         data.iePrimitiveCount = m_IePrimitiveCountBuffer.DevicePointerCast<uint32_t>();
         data.iePrimitiveInfos = m_IePrimitiveInfoBuffer.DevicePointerCast<IEPrimitiveInfo>();
+        data.ieClusters = m_IeClusterBuffer.DevicePointerCast<IECluster>();
+        data.ieClusterCount = m_IeClusterCountBuffer.DevicePointerCast<uint32_t>();
         data.ieVoxelFactor = m_Params.ieVoxelAxisSizeFactor;
         m_VoxelPointDataBuffer = DeviceBuffer::Create(m_VoxelPointData);
         data.voxelPointData = m_VoxelPointDataBuffer.DevicePointerCast<VoxelPointData>();
@@ -535,7 +1262,7 @@ namespace VCT
         uint32_t gridCount = Utils::GetLaunchCount(GetVoxelCount(), m_Params.blockSize);
         KernelData::Get().GetVoxelizePointCloudKernel().LaunchAndSynchronize(glm::uvec3(gridCount, 1, 1), glm::uvec3(m_Params.blockSize, 1, 1));
         m_IeCountBuffer.Download(&m_IeCount, 1);
-        LOG("Intersectable Entity Count: %u", m_IeCount);
+        LOG("Intersectable Entity Count: %u, Cluster Count: %u", m_IeCount, m_IeClusterCount);
 
         gridCount = Utils::GetLaunchCount(m_IePrimitiveCount, m_Params.blockSize);
         LOG("Refine primitive count: %u %u %u", m_SubIePrimitiveCount, m_IePrimitiveCount, m_NumberOfSurfacePoints);
@@ -543,7 +1270,13 @@ namespace VCT
         gridCount = Utils::GetLaunchCount(m_SubIePrimitiveCount, m_Params.blockSize);
         KernelData::Get().GetWriteRefinePrimitiveNeighborsKernel().LaunchAndSynchronize(glm::uvec3(gridCount, 1, 1), glm::uvec3(m_Params.blockSize, 1, 1));
 
-        m_TransmitterBuffer = DeviceBuffer::Create(m_Params.transmitters);
+        std::vector<Transmitter> sources = m_Params.transmitters;
+        if (m_Params.bidirectionalSearch)
+        {
+            for (const Receiver& rx : m_Params.receivers)
+                sources.emplace_back(rx.position);
+        }
+        m_TransmitterBuffer = DeviceBuffer::Create(sources);
         m_ReceiverBuffer = DeviceBuffer::Create(m_Params.receivers);
         m_NumReceivedPathsBuffer = DeviceBuffer(sizeof(uint32_t));
         m_NumReceivedPathsBuffer.MemsetZero();
@@ -553,8 +1286,21 @@ namespace VCT
         m_ActiveBufferIndexBuffer = DeviceBuffer(sizeof(uint32_t));
         m_ActiveBufferIndexBuffer.Upload(&m_ActiveRecvBufferIndex, 1);
 
+        if (m_UseLabelHashing && !m_Params.deterministicEmission && m_Params.numOfCoarsePathsPerUniqueRoute > 0)
+        {
+            m_RouteTableSize = 1u << 16;
+            while (m_RouteTableSize < 2 * m_Params.receivedPathBufferSize)
+                m_RouteTableSize <<= 1;
+
+            m_RouteTableBuffer = DeviceBuffer(sizeof(RouteEntry) * m_RouteTableSize);
+            m_NumRejectedPathsBuffer = DeviceBuffer(sizeof(uint32_t));
+            LOG("Route table size: %u", m_RouteTableSize);
+        }
+
         m_PropPathBuffers.resize(m_Params.maximumNumberOfInteractions);
         m_PropagationStatuses.resize(m_Params.maximumNumberOfInteractions);
+        m_EmissionRanges.resize(m_Params.maximumNumberOfInteractions + 1);
+        m_NumBeamKeptRays.resize(m_Params.maximumNumberOfInteractions);
 
         std::vector<PropagationData*> propPathPtr;
         propPathPtr.reserve(m_Params.maximumNumberOfInteractions);
@@ -589,6 +1335,34 @@ namespace VCT
         m_PathProcessingDataBuffer = DeviceBuffer(sizeof(PathProcessingData));
         m_PathProcessingDataBuffer.MemsetZero();
 
+        EmissionData emissionData{};
+        emissionData.mode = EmissionMode::Atomic;
+        if (m_Params.deterministicEmission)
+        {
+            uint32_t maxLaunchCount = std::max(m_IeCount, m_MaxNumPropPaths.size() ? *std::max_element(m_MaxNumPropPaths.begin(), m_MaxNumPropPaths.end()) : 0u);
+            m_EmissionCountBuffer = DeviceBuffer(sizeof(uint2) * maxLaunchCount);
+            emissionData.counts = m_EmissionCountBuffer.DevicePointerCast<uint2>();
+        }
+        m_EmissionDataBuffer = DeviceBuffer::Create(std::vector<EmissionData>{ emissionData });
+
+        m_BeamDataBuffer = DeviceBuffer(sizeof(BeamData));
+        m_BeamDataBuffer.MemsetZero();
+        if ((m_Params.beamWidth > 0 || m_Params.rayMergeLimit > 0) && m_MaxNumPropPaths.size())
+        {
+            uint32_t maxNumPropPaths = *std::max_element(m_MaxNumPropPaths.begin(), m_MaxNumPropPaths.end());
+            m_BeamCandidateBuffer = DeviceBuffer(sizeof(BeamCandidate) * maxNumPropPaths);
+            m_BeamKeepBuffer = DeviceBuffer(sizeof(uint8_t) * maxNumPropPaths);
+        }
+
+        m_ActiveRayDataBuffer = DeviceBuffer(sizeof(ActiveRayData));
+        m_ActiveRayDataBuffer.MemsetZero();
+        if (!m_Params.deterministicEmission)
+        {
+            m_ActiveRayIndexBuffers.resize(m_MaxNumPropPaths.size() * 2);
+            for (size_t i = 0; i < m_ActiveRayIndexBuffers.size(); ++i)
+                m_ActiveRayIndexBuffers[i] = DeviceBuffer(sizeof(uint32_t) * m_MaxNumPropPaths[i / 2]);
+        }
+
         m_TransmitIndexProcessedBuffer = DeviceBuffer(sizeof(uint8_t) * m_IeCount);
         m_VCTStatusBuffer = DeviceBuffer(sizeof(Status));
         m_DepthLevelBuffer = DeviceBuffer(sizeof(int32_t));
@@ -596,54 +1370,78 @@ namespace VCT
 
     void VoxelConeTracer::CreateVoxelTexture()
     {
-        cudaArray* arr;
-        cudaExtent extent = make_cudaExtent(m_VoxelDimensions.x, m_VoxelDimensions.y, m_VoxelDimensions.z);
-        cudaChannelFormatDesc desc = cudaCreateChannelDesc<uint2>();
-        CUDA_CHECK(cudaMalloc3DArray(&arr, &desc, extent, 0));
-
         uint32_t gridCount = Utils::GetLaunchCount(GetVoxelCount(), m_Params.blockSize);
         KernelData::Get().GetFillTextureDataKernel().LaunchAndSynchronize(glm::vec3(gridCount, 1, 1), glm::vec3(m_Params.blockSize, 1, 1));
+        m_VoxelTexture = CreateTexture<uint8_t>(m_VoxelFieldDataBuffer, m_VoxelDimensions, 0, cudaResViewFormatUnsignedChar1);
 
-        cudaMemcpy3DParms copyParams{};
-        copyParams.srcPtr = make_cudaPitchedPtr(m_VoxelTextureDataBuffer.DevicePointerCast<void>(), extent.width * sizeof(uint2), extent.width, extent.height);
-        copyParams.dstArray = arr;
-        copyParams.extent = extent;
-        copyParams.kind = cudaMemcpyDeviceToDevice;
-        CUDA_CHECK(cudaMemcpy3D(&copyParams));
-        CUDA_CHECK(cudaDeviceSynchronize());
+        if (m_Params.useDirectionalSkipDistances)
+            m_VoxelOctantTexture = CreateTexture<uint2>(m_VoxelOctantDataBuffer, m_VoxelDimensions, 0, cudaResViewFormatUnsignedInt2);
+    }
 
-        cudaResourceDesc resourceDesc{};
-        resourceDesc.resType = cudaResourceTypeArray;
-        resourceDesc.res.array.array = arr;
+    void VoxelConeTracer::BuildLabelVisibility()
+    {
+        PROFILE_SCOPE();
+        std::vector<IntersectableEntity> intersectableEntities(m_IeCount);
+        m_IntersectableEntityBuffer.Download(intersectableEntities.data(), m_IeCount);
 
-        cudaTextureDesc textureDesc{};
-        textureDesc.addressMode[0] = cudaAddressModeBorder;
-        textureDesc.addressMode[1] = cudaAddressModeBorder;
-        textureDesc.addressMode[2] = cudaAddressModeBorder;
-        textureDesc.filterMode = cudaFilterModePoint;
-        textureDesc.readMode = cudaReadModeElementType;
-        textureDesc.sRGB = false;
-        uint32_t borderColor = Constants::InvalidPointIndex;
-        textureDesc.borderColor[0] = reinterpret_cast<float&>(borderColor);
-        textureDesc.borderColor[1] = reinterpret_cast<float&>(borderColor);
-        textureDesc.normalizedCoords = false;
-        textureDesc.maxAnisotropy = 0;
-        textureDesc.mipmapFilterMode = cudaFilterModePoint;
-        textureDesc.mipmapLevelBias = 0.0f;
-        textureDesc.minMipmapLevelClamp = 0.0f;
-        textureDesc.maxMipmapLevelClamp = 0.0f;
+        uint32_t numLabels = 0;
+        std::unordered_map<uint32_t, std::vector<uint32_t>> ieIDsByLabel;
+        for (uint32_t ieID = 0; ieID < m_IeCount; ++ieID)
+        {
+            const IntersectableEntity& ie = intersectableEntities[ieID];
+            if (ie.type == IEType::Surface && ie.surfaceLabel != Constants::InvalidPointIndex)
+            {
+                ieIDsByLabel[ie.surfaceLabel].push_back(ieID);
+                numLabels = glm::max(numLabels, ie.surfaceLabel + 1);
+            }
+        }
 
-        cudaResourceViewDesc viewDesc{};
-        viewDesc.format = cudaResViewFormatUnsignedInt2;
-        viewDesc.width = m_VoxelDimensions.x;
-        viewDesc.height = m_VoxelDimensions.y;
-        viewDesc.depth = m_VoxelDimensions.z;
-        viewDesc.firstMipmapLevel = 0;
-        viewDesc.lastMipmapLevel = 0;
-        viewDesc.firstLayer = 0;
-        viewDesc.lastLayer = 0;
+        uint64_t numBits = static_cast<uint64_t>(numLabels) * numLabels;
+        if (numLabels == 0 || numBits > MaximumLabelVisibilityBits)
+        {
+            LOG("Label visibility disabled: %u labels", numLabels);
+            return;
+        }
 
-        CUDA_CHECK(cudaCreateTextureObject(&m_VoxelTexture, &resourceDesc, &textureDesc, &viewDesc));
+        std::vector<uint32_t> sampleIeIDs;
+        for (const auto& [label, ieIDs] : ieIDsByLabel)
+        {
+            size_t numSamples = glm::min(static_cast<size_t>(m_Params.labelVisibilitySamples), ieIDs.size());
+            for (size_t i = 0; i < numSamples; ++i)
+                sampleIeIDs.push_back(ieIDs[i * ieIDs.size() / numSamples]);
+        }
+
+        // The launch only tests sample pairs with x < y, so a label is marked as seeing itself up front.
+        size_t numWords = static_cast<size_t>((numBits + 31) / 32);
+        std::vector<uint32_t> visibleLabels(numWords, 0u);
+        for (uint32_t label = 0; label < numLabels; ++label)
+        {
+            uint64_t bit = static_cast<uint64_t>(label) * numLabels + label;
+            visibleLabels[bit >> 5] |= 1u << (bit & 31u);
+        }
+        m_LabelVisibilityBuffer = DeviceBuffer::Create(visibleLabels);
+        DeviceBuffer sampleIeIDBuffer = DeviceBuffer::Create(sampleIeIDs);
+
+        LabelVisibilityData& labelVisibility = m_VCTData.coneTracingData.labelVisibility;
+        labelVisibility.visibleLabels = m_LabelVisibilityBuffer.DevicePointerCast<uint32_t>();
+        labelVisibility.numLabels = numLabels;
+        labelVisibility.sampleIeIDs = sampleIeIDBuffer.DevicePointerCast<uint32_t>();
+        labelVisibility.numSamples = static_cast<uint32_t>(sampleIeIDs.size());
+        m_VCTDataBuffer.Upload(&m_VCTData, 1);
+        KernelData::Get().GetLabelVisibilityPipeline().LaunchAndSynchronize(m_VCTDataBuffer, glm::uvec3(labelVisibility.numSamples, labelVisibility.numSamples, 1));
+
+        labelVisibility.sampleIeIDs = nullptr;
+        labelVisibility.numSamples = 0;
+        m_VCTDataBuffer.Upload(&m_VCTData, 1);
+
+        m_LabelVisibilityBuffer.Download(visibleLabels.data(), numWords);
+        uint64_t numVisiblePairs = 0;
+        for (uint32_t word : visibleLabels)
+            numVisiblePairs += std::bitset<32>(word).count();
+
+        uint64_t numUsedPairs = static_cast<uint64_t>(ieIDsByLabel.size()) * ieIDsByLabel.size();
+        LOG("Label visibility: %u labels, %zu samples, %llu of %llu label pairs visible (%.1f%% pruned)", static_cast<uint32_t>(ieIDsByLabel.size()), sampleIeIDs.size(),
+            static_cast<unsigned long long>(numVisiblePairs), static_cast<unsigned long long>(numUsedPairs), 100.0 * (1.0 - static_cast<double>(numVisiblePairs) / static_cast<double>(numUsedPairs)));
     }
 
     void VoxelConeTracer::PrepareTrace(uint32_t transmitterID)
@@ -662,11 +1460,24 @@ namespace VCT
         ppData.nextNumPathsToProcess = 0;
         m_PathProcessingDataBuffer.Upload(&ppData, 1);
         m_DepthLevel = -1;
+        m_EmissionRanges[0] = EmissionRange();
+        if (m_Params.maxTimeDelay > 0.0f)
+            m_NumDelayPrunedRaysBuffer.MemsetZero();
+        if (m_Params.maxPathLoss > 0.0f)
+            m_NumPathLossPrunedRaysBuffer.MemsetZero();
+        m_DiffractionStatisticsBuffer.MemsetZero();
+        m_NumBeamPrunedRays = 0;
+        std::fill(m_NumBeamKeptRays.begin(), m_NumBeamKeptRays.end(), 0);
+        if (m_RouteTableSize)
+        {
+            m_RouteTableBuffer.MemsetZero();
+            m_NumRejectedPathsBuffer.MemsetZero();
+        }
     }
 
     void VoxelConeTracer::IncreaseDepth()
     {
-        if (++m_DepthLevel < static_cast<int32_t>(m_Params.maximumNumberOfInteractions))
+        if (++m_DepthLevel < static_cast<int32_t>(GetInteractionLimit()))
         {
             PathProcessingData ppData{};
             m_PathProcessingDataBuffer.Download(&ppData, 1);
@@ -675,9 +1486,14 @@ namespace VCT
             ppData.nextNumPathsToProcess = 0;
             m_PathProcessingDataBuffer.Upload(&ppData, 1);
             m_PropagationStatuses[m_DepthLevel] = { Status::ProcessingRequired, ppData.numPathsToProcess };
+            m_EmissionRanges[m_DepthLevel + 1] = EmissionRange();
             Status resetStatus = Status::Finished;
             m_VCTStatusBuffer.Upload(&resetStatus, 1);
             m_DepthLevelBuffer.Upload(&m_DepthLevel, 1);
+            if (m_Params.beamWidth > 0 || m_Params.rayMergeLimit > 0)
+                SelectPropagationRays(ppData.numPathsToProcess);
+            if (m_CaptureFrontierRays && ppData.numPathsToProcess)
+                CaptureFrontierRays(ppData.numPathsToProcess);
         }
     }
    
@@ -693,6 +1509,14 @@ namespace VCT
             Status resetStatus = Status::Finished;
             m_VCTStatusBuffer.Upload(&resetStatus, 1);
         }
+        else if (m_DepthLevel == -1)
+        {
+            PathProcessingData ppData{};
+            ppData.numPathsToProcess = m_IeCount;
+            m_PathProcessingDataBuffer.Upload(&ppData, 1);
+            Status resetStatus = Status::Finished;
+            m_VCTStatusBuffer.Upload(&resetStatus, 1);
+        }
     }
 
     void VoxelConeTracer::Transmit()
@@ -701,8 +1525,15 @@ namespace VCT
         {
             PROFILE_SCOPE();
             LOG("Transmit Launch Count: %u", m_IeCount);
-            KernelData::Get().GetTransmitPipeline().LaunchAndSynchronize(m_VCTDataBuffer, glm::uvec3(m_IeCount, 1, 1));
-            m_VCTStatusBuffer.Download(&m_TransmitStatus, 1);
+            if (m_Params.deterministicEmission)
+            {
+                m_TransmitStatus = LaunchWithOrderedEmission(KernelData::Get().GetTransmitPipeline(), m_EmissionRanges[0], m_IeCount, 0);
+            }
+            else
+            {
+                KernelData::Get().GetTransmitPipeline().LaunchAndSynchronize(m_VCTDataBuffer, glm::uvec3(m_IeCount, 1, 1));
+                m_VCTStatusBuffer.Download(&m_TransmitStatus, 1);
+            }
             IncreaseDepth();
         }
         else
@@ -711,32 +1542,171 @@ namespace VCT
 
     void VoxelConeTracer::Propagate()
     {
-        if (m_DepthLevel < static_cast<int32_t>(m_Params.maximumNumberOfInteractions) && m_PropagationStatuses[m_DepthLevel].ProcessingRequired())
+        if (m_DepthLevel < static_cast<int32_t>(GetInteractionLimit()) && m_PropagationStatuses[m_DepthLevel].ProcessingRequired())
         {
             PROFILE_SCOPE();            
             PropagationStatus& propStatus = m_PropagationStatuses[m_DepthLevel];
             LOG("Propagate depthLevel: %i, launchCount %u", m_DepthLevel, propStatus.launchCount);
-            KernelData::Get().GetPropagationPipeline().LaunchAndSynchronize(m_VCTDataBuffer, glm::uvec3(propStatus.launchCount, 1, 1));
-            m_VCTStatusBuffer.Download(&propStatus.status, 1);
+            if (m_Params.deterministicEmission)
+            {
+                uint32_t childDepth = static_cast<uint32_t>(m_DepthLevel) + 1;
+                propStatus.status = LaunchWithOrderedEmission(KernelData::Get().GetPropagationPipeline(), m_EmissionRanges[childDepth], propStatus.launchCount, childDepth);
+            }
+            else
+            {
+                int32_t nextActiveRayList = propStatus.activeRayList == 0 ? 1 : 0;
+                ActiveRayData activeRayData{};
+                if (propStatus.activeRayList >= 0)
+                    activeRayData.rayIndices = m_ActiveRayIndexBuffers[m_DepthLevel * 2 + propStatus.activeRayList].DevicePointerCast<uint32_t>();
+                activeRayData.nextRayIndices = m_ActiveRayIndexBuffers[m_DepthLevel * 2 + nextActiveRayList].DevicePointerCast<uint32_t>();
+                m_ActiveRayDataBuffer.Upload(&activeRayData, 1);
+
+                KernelData::Get().GetPropagationPipeline().LaunchAndSynchronize(m_VCTDataBuffer, glm::uvec3(propStatus.launchCount, 1, 1));
+                m_VCTStatusBuffer.Download(&propStatus.status, 1);
+                m_ActiveRayDataBuffer.Download(&activeRayData, 1);
+                propStatus.launchCount = activeRayData.numNextRays;
+                propStatus.activeRayList = nextActiveRayList;
+            }
             uint32_t numPaths = 0;
             m_NumReceivedPathsBuffer.Download(&numPaths, 1);
             if (numPaths >= m_Params.receivedPathBufferSize)
-            {
-                if (m_TransferStatus.valid())
-                    m_TransferStatus.wait();
+                FlushReceivedPaths(numPaths);
 
-                m_NumReceivedPathsBuffer.MemsetZero();
-                uint32_t bufferIdx = m_ActiveRecvBufferIndex;
-                m_ActiveRecvBufferIndex = m_ActiveRecvBufferIndex ^ 1u;
-                m_TransferStatus = std::async(std::launch::async, &VoxelConeTracer::RetrievePaths, this, &m_CoarsePathBuffers[bufferIdx], glm::min(numPaths, m_Params.receivedPathBufferSize));
-                m_ActiveBufferIndexBuffer.Upload(&m_ActiveRecvBufferIndex, 1);
-            }
             IncreaseDepth();
         }
         else
             DecreaseDepth();
     }
 
+    void VoxelConeTracer::LaunchEmission(const RTPipeline& pipeline, EmissionMode mode, uint32_t first, uint32_t count)
+    {
+        EmissionData emissionData{};
+        emissionData.mode = mode;
+        emissionData.launchOffset = first;
+        emissionData.counts = m_EmissionCountBuffer.DevicePointerCast<uint2>();
+        m_EmissionDataBuffer.Upload(&emissionData, 1);
+        pipeline.LaunchAndSynchronize(m_VCTDataBuffer, glm::uvec3(count, 1, 1));
+
+        if (mode == EmissionMode::Count)
+        {
+            m_EmissionCounts.resize(count);
+            m_EmissionCountBuffer.Download(m_EmissionCounts.data(), count);
+        }
+    }
+
+    Status VoxelConeTracer::LaunchWithOrderedEmission(const RTPipeline& pipeline, EmissionRange& range, uint32_t launchCount, uint32_t childDepth)
+    {
+        uint32_t propagationPathCapacity = childDepth < GetInteractionLimit() ? m_MaxNumPropPaths[childDepth] : std::numeric_limits<uint32_t>::max();
+        uint32_t numCountLaunches = 0;
+        uint32_t numWriteLaunches = 0;
+        if (range.offsets.empty())
+        {
+            LaunchEmission(pipeline, EmissionMode::Count, 0, launchCount);
+            ExclusiveScan(m_EmissionCounts, range.offsets);
+            range.first = 0;
+            range.headCount = launchCount ? range.offsets[1] - range.offsets[0] : glm::u64vec2(0);
+            ++numCountLaunches;
+        }
+
+        const uint64_t receivedPathCapacity = m_Params.receivedPathBufferSize;
+        while (range.first < launchCount)
+        {
+            PathProcessingData ppData{};
+            m_PathProcessingDataBuffer.Download(&ppData, 1);
+            uint32_t numReceivedPaths = 0;
+            m_NumReceivedPathsBuffer.Download(&numReceivedPaths, 1);
+            glm::u64vec2 fill = glm::u64vec2(ppData.numPaths, numReceivedPaths);
+            glm::u64vec2 capacity = glm::u64vec2(propagationPathCapacity, receivedPathCapacity);
+            glm::u64vec2 available = glm::u64vec2(capacity.x - glm::min(fill.x, capacity.x), capacity.y - glm::min(fill.y, capacity.y));
+
+            uint32_t end = range.first;
+            uint32_t count = launchCount - range.first;
+            while (count > 0)
+            {
+                uint32_t step = count / 2;
+                glm::u64vec2 sum = range.Sum(end + step + 1);
+                if (sum.x <= available.x && sum.y <= available.y)
+                {
+                    end += step + 1;
+                    count -= step + 1;
+                }
+                else
+                    count = step;
+            }
+
+            if (end > range.first)
+            {
+                m_EmissionCounts.resize(end - range.first);
+                for (uint32_t i = range.first; i < end; ++i)
+                {
+                    glm::u64vec2 offset = glm::min(fill + range.Sum(i), glm::u64vec2(std::numeric_limits<uint32_t>::max()));
+                    m_EmissionCounts[i - range.first] = { static_cast<uint32_t>(offset.x), static_cast<uint32_t>(offset.y) };
+                }
+                m_EmissionCountBuffer.Upload(m_EmissionCounts.data(), m_EmissionCounts.size());
+                LaunchEmission(pipeline, EmissionMode::Write, range.first, end - range.first);
+                ++numWriteLaunches;
+
+                range.first = end;
+                if (range.first < launchCount)
+                    range.headCount = range.offsets[range.first + 1] - range.offsets[range.first];
+            }
+            else if (fill.y > 0 && range.headCount.y > available.y)
+                FlushReceivedPaths(numReceivedPaths);
+            else if (fill.x > 0)
+                break;
+            else
+            {
+                uint2 offset = { static_cast<uint32_t>(fill.x), static_cast<uint32_t>(fill.y) };
+                m_EmissionCountBuffer.Upload(&offset, 1);
+                LaunchEmission(pipeline, EmissionMode::Write, range.first, 1);
+                LaunchEmission(pipeline, EmissionMode::Count, range.first, 1);
+                ++numWriteLaunches;
+                ++numCountLaunches;
+
+                glm::u64vec2 remaining = glm::u64vec2(m_EmissionCounts[0].x, m_EmissionCounts[0].y);
+                if (remaining != range.headCount)
+                    range.headCount = remaining;
+                else if (childDepth < GetInteractionLimit() && remaining.x > capacity.x)
+                {
+                    // A single fan-out is allocated at once, so the empty buffer has to hold all remaining children of this ray.
+                    GrowPropagationPathBuffer(childDepth, static_cast<uint32_t>(remaining.x));
+                    propagationPathCapacity = m_MaxNumPropPaths[childDepth];
+                }
+                else
+                    throw std::runtime_error("Ordered emission: ray " + std::to_string(range.first) + " does not fit into empty path buffers.");
+            }
+        }
+
+        EmissionData emissionData{};
+        emissionData.mode = EmissionMode::Atomic;
+        m_EmissionDataBuffer.Upload(&emissionData, 1);
+
+        LOG("Ordered emission: %u/%u rays done, %u count launches, %u write launches", range.first, launchCount, numCountLaunches, numWriteLaunches);
+        return range.first < launchCount ? Status::ProcessingRequired : Status::Finished;
+    }
+
+    void VoxelConeTracer::GrowPropagationPathBuffer(uint32_t depth, uint32_t numPaths)
+    {
+        LOG("PropBufferSize at index %u grown: %u -> %u", depth, m_MaxNumPropPaths[depth], numPaths);
+        m_PropPathBuffers[depth] = DeviceBuffer(sizeof(PropagationData) * numPaths);
+        m_MaxNumPropPaths[depth] = numPaths;
+
+        std::vector<PropagationData*> propPathPtr;
+        propPathPtr.reserve(m_PropPathBuffers.size());
+        for (const DeviceBuffer& propBuffer : m_PropPathBuffers)
+            propPathPtr.emplace_back(propBuffer.DevicePointerCast<PropagationData>());
+        m_PropPathPointerBuffer.Upload(propPathPtr.data(), propPathPtr.size());
+        m_MaxNumPropPathBuffer.Upload(m_MaxNumPropPaths.data(), m_MaxNumPropPaths.size());
+
+        if (m_EmissionCountBuffer.GetSize() < sizeof(uint2) * numPaths)
+            m_EmissionCountBuffer = DeviceBuffer(sizeof(uint2) * numPaths);
+        if (m_BeamCandidateBuffer && m_BeamCandidateBuffer.GetSize() < sizeof(BeamCandidate) * numPaths)
+        {
+            m_BeamCandidateBuffer = DeviceBuffer(sizeof(BeamCandidate) * numPaths);
+            m_BeamKeepBuffer = DeviceBuffer(sizeof(uint8_t) * numPaths);
+        }
+    }
+
     void VoxelConeTracer::TraceTransmitter(uint32_t transmitterID)
     {
         PrepareTrace(transmitterID);
@@ -759,13 +1729,38 @@ namespace VCT
 
             uint32_t totalPaths = 0;
             for (uint32_t rxID = 0; rxID < m_Params.receivers.size(); ++rxID)
-            {
-                auto paths = m_CoarsePathStorage.GetPaths(transmitterID, rxID);
-                totalPaths += paths ? static_cast<uint32_t>(paths->size()) : 0u;
-            }
+                totalPaths += m_CoarsePathStorage.GetNumPaths(transmitterID, rxID);
 
             LOG("Coarse paths for TX: %u\n", totalPaths);
         }
+        if (m_RouteTableSize)
+        {
+            uint32_t numRejectedPaths = 0;
+            m_NumRejectedPathsBuffer.Download(&numRejectedPaths, 1);
+            LOG("Paths rejected by route table: %u", numRejectedPaths);
+        }
+        if (m_Params.beamWidth > 0)
+            LOG("Rays pruned by beam width: %u", m_NumBeamPrunedRays);
+        if (m_Params.maxTimeDelay > 0.0f)
+        {
+            uint32_t numPrunedRays = 0;
+            m_NumDelayPrunedRaysBuffer.Download(&numPrunedRays, 1);
+            LOG("Rays pruned by max time delay: %u", numPrunedRays);
+        }
+        if (m_Params.maxPathLoss > 0.0f)
+        {
+            uint32_t numPrunedRays = 0;
+            m_NumPathLossPrunedRaysBuffer.Download(&numPrunedRays, 1);
+            LOG("Rays pruned by max path loss: %u", numPrunedRays);
+        }
+        if (m_Params.maximumNumberOfDiffractions > 0)
+        {
+            DiffractionStatistics statistics{};
+            m_DiffractionStatisticsBuffer.Download(&statistics, 1);
+            float raysPerHit = statistics.numEdgeHits ? static_cast<float>(statistics.numEmittedRays) / statistics.numEdgeHits : 0.0f;
+            LOG("Diffraction: %u edge hits, %u rays emitted (%.2f per hit), %u invalid, %u culled by receivers",
+                statistics.numEdgeHits, statistics.numEmittedRays, raysPerHit, statistics.numInvalidRays, statistics.numCulledRays);
+        }
     }
 
     void VoxelConeTracer::CalculateDiffractionRays()
@@ -789,40 +1784,81 @@ namespace VCT
         float percent = static_cast<float>(numDiffRays) / static_cast<float>(Constants::UnitCircleDiscretizationCount);
         constexpr float factor = 1.0f / static_cast<float>(Constants::UnitCircleDiscretizationCount);
 
-        uint32_t infosRayFirstIndex = 0;
-        m_DiffractionRayIndexInfos.reserve(static_cast<size_t>(Constants::UnitCircleDiscretizationCount + 1) * m_DiffractionEdges.size());
-        m_DiffractionRays.reserve(static_cast<size_t>(Constants::UnitCircleDiscretizationCount + 1) * m_DiffractionEdges.size() * numDiffRays);
-
-        for (DiffractionEdge& edge : m_DiffractionEdges)
+        // Tables only depend on the wedge opening angle; each edge rotates the shared table by its start angle.
+        std::unordered_map<uint32_t, uint32_t> tableIndices;
+        std::vector<uint32_t> tableWedgeKeys;
+        std::vector<uint32_t> edgeTableIndices(m_DiffractionEdges.size());
+        for (size_t edgeIndex = 0; edgeIndex < m_DiffractionEdges.size(); ++edgeIndex)
         {
-            edge.firstInfoIndex = static_cast<uint32_t>(m_DiffractionRayIndexInfos.size());
+            DiffractionEdge& edge = m_DiffractionEdges[edgeIndex];
             float startAngle = FindDiffractionAngleRadsFromNormals(edge.localSurfaceDir2D0, edge.localSurfaceDir2D1);
-            float surfaceAngleCos = glm::dot(edge.localSurfaceDir2D0, edge.localSurfaceDir2D1);
-            float surfaceAngleRads = std::acosf(surfaceAngleCos);
-            float diffRayAreaRads = pi2 - surfaceAngleRads;
+            float surfaceAngleRads = std::acosf(glm::clamp(glm::dot(edge.localSurfaceDir2D0, edge.localSurfaceDir2D1), -1.0f, 1.0f));
+            uint32_t wedgeKey = glm::min(static_cast<uint32_t>(std::lround(surfaceAngleRads / pi2 * Constants::WedgeAngleDiscretizationCount)), Constants::WedgeAngleDiscretizationCount - 1);
+            edge.rayRotation = glm::vec2(std::sinf(startAngle), std::cosf(startAngle));
+
+            auto [it, inserted] = tableIndices.try_emplace(wedgeKey, static_cast<uint32_t>(tableWedgeKeys.size()));
+            if (inserted)
+                tableWedgeKeys.push_back(wedgeKey);
+            edgeTableIndices[edgeIndex] = it->second;
+        }
 
-            for (size_t diffractionIndex = 0; diffractionIndex <= Constants::UnitCircleDiscretizationCount; ++diffractionIndex)
+        std::vector<std::vector<IndexInfo>> tableInfos(tableWedgeKeys.size());
+        std::vector<std::vector<DiffractionRay>> tableRays(tableWedgeKeys.size());
+        std::atomic<size_t> nextTable{ 0 };
+        std::vector<std::future<void>> workers;
+        for (uint32_t i = 0; i < glm::min(glm::max(std::thread::hardware_concurrency(), 1u), static_cast<uint32_t>(tableWedgeKeys.size())); ++i)
+        {
+            workers.push_back(std::async(std::launch::async, [&]()
             {
-                float cAngle = radDiffAngle / ((diffractionIndex + 1) * factor);
-                float halfAngle = cAngle / 2;
-                uint32_t numRays = static_cast<uint32_t>(std::ceil(diffRayAreaRads / cAngle));
-                cAngle = diffRayAreaRads / numRays;
-                float angle = startAngle + halfAngle;
-
-                m_DiffractionRayIndexInfos.push_back({ infosRayFirstIndex, numRays });
-                infosRayFirstIndex += numRays;
-
-                for (uint32_t rayIndex = 0; rayIndex < numRays; ++rayIndex)
+                for (size_t tableIndex = nextTable++; tableIndex < tableWedgeKeys.size(); tableIndex = nextTable++)
                 {
-                    DiffractionRay ray{};
-                    ray.direction = glm::vec2(std::sinf(angle), std::cosf(angle));
-                    ray.planeDirections[0] = glm::vec2(std::sinf(angle + halfAngle), std::cosf(angle + halfAngle));
-                    ray.planeDirections[1] = glm::vec2(std::sinf(angle - halfAngle), std::cosf(angle - halfAngle));
-                    m_DiffractionRays.push_back(ray);
-                    angle += cAngle;
+                    float diffRayAreaRads = pi2 - tableWedgeKeys[tableIndex] * (pi2 / Constants::WedgeAngleDiscretizationCount);
+                    std::vector<IndexInfo>& infos = tableInfos[tableIndex];
+                    std::vector<DiffractionRay>& rays = tableRays[tableIndex];
+                    infos.reserve(Constants::UnitCircleDiscretizationCount + 1);
+                    uint32_t infosRayFirstIndex = 0;
+                    for (size_t diffractionIndex = 0; diffractionIndex <= Constants::UnitCircleDiscretizationCount; ++diffractionIndex)
+                    {
+                        float cAngle = radDiffAngle / ((diffractionIndex + 1) * factor);
+                        float halfAngle = cAngle / 2;
+                        uint32_t numRays = static_cast<uint32_t>(std::ceil(diffRayAreaRads / cAngle));
+                        cAngle = diffRayAreaRads / numRays;
+                        float angle = halfAngle;
+
+                        infos.push_back({ infosRayFirstIndex, numRays });
+                        infosRayFirstIndex += numRays;
+
+                        for (uint32_t rayIndex = 0; rayIndex < numRays; ++rayIndex)
+                        {
+                            DiffractionRay ray{};
+                            ray.direction = glm::vec2(std::sinf(angle), std::cosf(angle));
+                            ray.planeDirections[0] = glm::vec2(std::sinf(angle + halfAngle), std::cosf(angle + halfAngle));
+                            ray.planeDirections[1] = glm::vec2(std::sinf(angle - halfAngle), std::cosf(angle - halfAngle));
+                            rays.push_back(ray);
+                            angle += cAngle;
+                        }
+                    }
                 }
-            }
+            }));
         }
+        for (auto& worker : workers)
+            worker.get();
+
+        std::vector<uint32_t> tableFirstInfoIndices(tableWedgeKeys.size());
+        for (size_t tableIndex = 0; tableIndex < tableWedgeKeys.size(); ++tableIndex)
+        {
+            uint32_t rayOffset = static_cast<uint32_t>(m_DiffractionRays.size());
+            tableFirstInfoIndices[tableIndex] = static_cast<uint32_t>(m_DiffractionRayIndexInfos.size());
+            for (const IndexInfo& info : tableInfos[tableIndex])
+                m_DiffractionRayIndexInfos.push_back({ info.first + rayOffset, info.count });
+            m_DiffractionRays.insert(m_DiffractionRays.end(), tableRays[tableIndex].begin(), tableRays[tableIndex].end());
+        }
+
+        for (size_t edgeIndex = 0; edgeIndex < m_DiffractionEdges.size(); ++edgeIndex)
+            m_DiffractionEdges[edgeIndex].firstInfoIndex = tableFirstInfoIndices[edgeTableIndices[edgeIndex]];
+
+        LOG("Diffraction tables: %zu wedge angles for %zu edges, %zu rays (%zu bytes)", tableWedgeKeys.size(), m_DiffractionEdges.size(), m_DiffractionRays.size(),
+            m_DiffractionRays.size() * sizeof(DiffractionRay) + m_DiffractionRayIndexInfos.size() * sizeof(IndexInfo));
     }
 
     VCTData VoxelConeTracer::CreateVCTData() const
@@ -830,6 +1866,8 @@ namespace VCT
         VCTData vctData{};
         vctData.sceneData.intersectableEntities = m_IntersectableEntityBuffer.DevicePointerCast<IntersectableEntity>();
         vctData.sceneData.transmitters = m_TransmitterBuffer.DevicePointerCast<Transmitter>();
+        vctData.sceneData.numTransmitters = static_cast<uint32_t>(m_Params.transmitters.size());
+        vctData.sceneData.numReceivers = static_cast<uint32_t>(m_Params.receivers.size());
         vctData.sceneData.receivers = m_ReceiverBuffer.DevicePointerCast<Receiver>();
         
         vctData.sceneData.rtParams.asHandle = m_AccelerationStructure.GetRawHandle();
@@ -854,7 +1892,23 @@ namespace VCT
         vctData.subIePrimitiveNeighbors = m_SubIePrimitiveNeighborsBuffer.DevicePointerCast<PrimitiveNeighbors>();
 
         vctData.coneTracingData.voxelTexture = m_VoxelTexture;
+        vctData.coneTracingData.voxelOctantTexture = m_VoxelOctantTexture;
+        if (m_Params.maxTimeDelay > 0.0f)
+        {
+            vctData.coneTracingData.delayBound.receiverDistances = m_ReceiverDistanceBuffer.DevicePointerCast<float>();
+            vctData.coneTracingData.delayBound.maxTimeDelay = m_Params.maxTimeDelay;
+            vctData.coneTracingData.delayBound.numPrunedRays = m_NumDelayPrunedRaysBuffer.DevicePointerCast<uint32_t>();
+        }
+        if (m_Params.maxPathLoss > 0.0f)
+        {
+            vctData.coneTracingData.pathLossBound.reflectionLosses = m_ReflectionLossBuffer.DevicePointerCast<float>();
+            vctData.coneTracingData.pathLossBound.numMaterials = static_cast<uint32_t>(m_Params.materials.size());
+            vctData.coneTracingData.pathLossBound.freeSpaceLossOffset = 20.0f * std::log10(4.0f * Constants::Pi / Channel(m_Params.frequency).waveLength);
+            vctData.coneTracingData.pathLossBound.maxPathLoss = m_Params.maxPathLoss;
+            vctData.coneTracingData.pathLossBound.numPrunedRays = m_NumPathLossPrunedRaysBuffer.DevicePointerCast<uint32_t>();
+        }
         vctData.coneTracingData.voxelInfos = m_VoxelInfoBuffer.DevicePointerCast<VoxelInfo>();
+        vctData.coneTracingData.ieClusters = m_IeClusterBuffer.DevicePointerCast<IECluster>();
         vctData.coneTracingData.voxelWorldInfo = VoxelWorldInfo(m_SceneAABB.min, m_Params.voxelSize, m_VoxelDimensions);
         vctData.coneTracingData.maximumNumberOfInteractions = m_Params.maximumNumberOfInteractions;
         vctData.coneTracingData.maximumNumberOfDiffractions = m_Params.maximumNumberOfDiffractions;
@@ -863,6 +1917,8 @@ namespace VCT
         vctData.coneTracingData.diffractionEdgeSegments = m_DiffractionEdgeSegmentBuffer.DevicePointerCast<DiffractionEdgeSegment>();
         vctData.coneTracingData.diffractionRays = m_DiffractionRayBuffer.DevicePointerCast<DiffractionRay>();
         vctData.coneTracingData.diffractionIndexInfos = m_DiffractionRayIndexInfoBuffer.DevicePointerCast<IndexInfo>();
+        vctData.coneTracingData.diffractionStatistics = m_DiffractionStatisticsBuffer.DevicePointerCast<DiffractionStatistics>();
+        vctData.coneTracingData.diffractionReceiverCulling = m_Params.diffractionReceiverCulling;
         vctData.coneTracingData.sinDiffuseAngle = m_DiffuseAngleSin;
         vctData.coneTracingData.cosDiffuseAngle = m_DiffuseAngleCos;
         
@@ -878,6 +1934,16 @@ namespace VCT
         vctData.pathData.coarsePaths[0] = m_CoarsePathBuffers[0].DevicePointerCast<TraceData>();
         vctData.pathData.coarsePaths[1] = m_CoarsePathBuffers[1].DevicePointerCast<TraceData>();
         vctData.pathData.activeBufferIndex = m_ActiveBufferIndexBuffer.DevicePointerCast<uint32_t>();
+        vctData.pathData.emissionData = m_EmissionDataBuffer.DevicePointerCast<EmissionData>();
+        vctData.pathData.activeRayData = m_ActiveRayDataBuffer.DevicePointerCast<ActiveRayData>();
+        vctData.pathData.beamData = m_BeamDataBuffer.DevicePointerCast<BeamData>();
+        if (m_RouteTableSize)
+        {
+            vctData.pathData.routeTable.entries = m_RouteTableBuffer.DevicePointerCast<RouteEntry>();
+            vctData.pathData.routeTable.mask = m_RouteTableSize - 1;
+            vctData.pathData.routeTable.maxPathsPerRoute = m_Params.numOfCoarsePathsPerUniqueRoute;
+            vctData.pathData.routeTable.numRejectedPaths = m_NumRejectedPathsBuffer.DevicePointerCast<uint32_t>();
+        }
 
         vctData.transmitIndexProcessed = m_TransmitIndexProcessedBuffer.DevicePointerCast<uint8_t>();
         vctData.status = m_VCTStatusBuffer.DevicePointerCast<Status>();
@@ -892,17 +1958,108 @@ namespace VCT
         cudaStream_t stream{};
         CUDA_CHECK(cudaStreamCreateWithFlags(&stream, cudaStreamNonBlocking));
         deviceBuffer->DownloadAsync(stream, m_TransferHostBuffer.get(), numPaths);
-        m_CoarsePathStorage.AddPaths(m_TransferHostBuffer.get(), numPaths, m_UseLabelHashing);
-        LOG("Retrieved %u coarse paths from device.", numPaths);
         CUDA_CHECK(cudaStreamSynchronize(stream));
         CUDA_CHECK(cudaStreamDestroy(stream));
+
+        m_CoarsePathStorage.AddPaths(m_TransferHostBuffer.get(), numPaths, m_UseLabelHashing, glm::max(std::thread::hardware_concurrency(), 1u));
+        LOG("Retrieved %u coarse paths from device.", numPaths);
+    }
+
+    // beam_width bounds the rays a depth propagates per transmitter. Batches are traced depth first, so the later batches of
+    // a depth do not exist yet when an earlier one is selected; each batch keeps its best rays from what is left of the budget.
+    void VoxelConeTracer::SelectPropagationRays(uint32_t numPaths)
+    {
+        uint32_t& numDepthKept = m_NumBeamKeptRays[m_DepthLevel];
+        uint32_t beamBudget = m_Params.beamWidth > 0 ? m_Params.beamWidth - glm::min(numDepthKept, m_Params.beamWidth) : std::numeric_limits<uint32_t>::max();
+        if (numPaths == 0 || (numPaths <= beamBudget && m_Params.rayMergeLimit == 0))
+        {
+            numDepthKept += numPaths;
+            return;
+        }
+
+        PROFILE_SCOPE();
+        BeamData beamData{};
+        beamData.mode = BeamMode::Gather;
+        beamData.candidates = m_BeamCandidateBuffer.DevicePointerCast<BeamCandidate>();
+        beamData.keep = m_BeamKeepBuffer.DevicePointerCast<uint8_t>();
+        m_BeamDataBuffer.Upload(&beamData, 1);
+        KernelData::Get().GetBeamPipeline().LaunchAndSynchronize(m_VCTDataBuffer, glm::uvec3(numPaths, 1, 1));
+
+        m_BeamCandidates.resize(numPaths);
+        m_BeamCandidateBuffer.Download(m_BeamCandidates.data(), numPaths);
+
+        std::vector<std::pair<float, uint32_t>> scores(numPaths);
+        for (uint32_t i = 0; i < numPaths; ++i)
+            scores[i] = { m_BeamScoreFunction(m_BeamCandidates[i]), i };
+
+        m_BeamKeep.assign(numPaths, 1);
+        uint32_t numKept = numPaths;
+        if (m_Params.rayMergeLimit > 0)
+        {
+            numKept -= MergeSimilarRays(scores);
+            scores.erase(std::remove_if(scores.begin(), scores.end(), [&](const std::pair<float, uint32_t>& score) { return !m_BeamKeep[score.second]; }), scores.end());
+        }
+
+        if (numKept > beamBudget)
+        {
+            PartitionSmallest(scores, beamBudget);
+            for (uint32_t i = beamBudget; i < numKept; ++i)
+                m_BeamKeep[scores[i].second] = 0;
+
+            LOG("Beam at depthLevel %i: kept %u of %u paths", m_DepthLevel, beamBudget, numKept);
+            m_NumBeamPrunedRays += numKept - beamBudget;
+            numKept = beamBudget;
+        }
+        numDepthKept += numKept;
+
+        if (numKept < numPaths)
+        {
+            m_BeamKeepBuffer.Upload(m_BeamKeep.data(), numPaths);
+            beamData.mode = BeamMode::Prune;
+            m_BeamDataBuffer.Upload(&beamData, 1);
+            KernelData::Get().GetBeamPipeline().LaunchAndSynchronize(m_VCTDataBuffer, glm::uvec3(numPaths, 1, 1));
+        }
+    }
+
+    uint32_t VoxelConeTracer::MergeSimilarRays(const std::vector<std::pair<float, uint32_t>>& scores)
+    {
+        std::vector<std::pair<float, uint32_t>> orderedScores = scores;
+        std::sort(orderedScores.begin(), orderedScores.end());
+
+        std::unordered_map<RayMergeKey, uint32_t> mergeKeyCounts;
+        mergeKeyCounts.reserve(orderedScores.size());
+        uint32_t numMerged = 0;
+        for (const auto& [score, rayIndex] : orderedScores)
+        {
+            const BeamCandidate& candidate = m_BeamCandidates[rayIndex];
+            RayMergeKey mergeKey{ RayRouteKey(candidate), glm::ivec3(glm::round(candidate.rayDirection / m_Params.rayMergeDirectionResolution)) };
+            if (++mergeKeyCounts[mergeKey] > m_Params.rayMergeLimit)
+            {
+                m_BeamKeep[rayIndex] = 0;
+                ++numMerged;
+            }
+        }
+        LOG("Ray merge at depthLevel %i: %u paths merged into %u keys", m_DepthLevel, numMerged, static_cast<uint32_t>(mergeKeyCounts.size()));
+        return numMerged;
+    }
+
+    void VoxelConeTracer::FlushReceivedPaths(uint32_t numPaths)
+    {
+        if (m_TransferStatus.valid())
+            m_TransferStatus.wait();
+
+        m_NumReceivedPathsBuffer.MemsetZero();
+        uint32_t bufferIdx = m_ActiveRecvBufferIndex;
+        m_ActiveRecvBufferIndex = m_ActiveRecvBufferIndex ^ 1u;
+        m_TransferStatus = std::async(std::launch::async, &VoxelConeTracer::RetrievePaths, this, &m_CoarsePathBuffers[bufferIdx], glm::min(numPaths, m_Params.receivedPathBufferSize));
+        m_ActiveBufferIndexBuffer.Upload(&m_ActiveRecvBufferIndex, 1);
     }
 
     void VoxelConeTracer::PostProcess(uint32_t txID, uint32_t rxID)
     {
         PROFILE_SCOPE();
-        auto* p = m_RefinedPathStorage.GetPaths(0, 0);
-        m_RefinedPathStorage.TryRemoveDuplicates(0, 0, m_Params.transmitters[0], m_Params.receivers[0], m_Channel.waveLength);
-        LOG("Number of refined paths after duplicate removal: %u", (p ? p->size() : 0));
+        m_RefinedPathStorage.TryRemoveDuplicates(txID, rxID, m_Params.transmitters[txID], m_Params.receivers[rxID], m_Channel.waveLength);
+        auto* p = m_RefinedPathStorage.GetPaths(txID, rxID);
+        LOG("Number of refined paths after duplicate removal: %u", (p ? p->Size() : 0u));
     }
 }
\ No newline at end of file
@@ -4,6 +4,7 @@
 #include "Common.hpp"
 #include "PathStorage.hpp"
 #include <future>
+#include <functional>
 #include "InputData.hpp"
 
 namespace VCT
@@ -24,14 +25,19 @@ namespace VCT
 
         void Trace();
         void Refine(uint32_t txID, uint32_t rxID);
+        void RefineAll();
         const std::string& GetTransmitterName(uint32_t txID) const { return m_TxIDs.at(txID); }
         const std::string& GetReceiverName(uint32_t rxID) const { return m_RxIDs.at(rxID); }
         const PathStorage& GetRefinedPathStorage() const { return m_RefinedPathStorage; }
 
+        using BeamScoreFunction = std::function<float(const BeamCandidate&)>;
+        void SetBeamScoreFunction(BeamScoreFunction scoreFunction) { m_BeamScoreFunction = std::move(scoreFunction); }
+
     private:
         const glm::vec3 GetWorldCenter() const { return (m_SceneAABB.max + m_SceneAABB.min) / 2.f; }
         const glm::uvec3& GetVoxelDimensions() const { return m_VoxelDimensions; }
         uint32_t GetVoxelCount() const { return m_VoxelDimensions.x * m_VoxelDimensions.y * m_VoxelDimensions.z; }
+        uint32_t GetInteractionLimit() const { return m_VCTData.coneTracingData.maximumNumberOfInteractions; }
 
         float GetIeVoxelSize() const { return m_Params.voxelSize / m_Params.ieVoxelAxisSizeFactor; }
         uint32_t GetIeVoxelCount() const { auto pcdDim = GetIeVoxelDimensions(); return pcdDim.x * pcdDim.y * pcdDim.z; }
@@ -46,29 +52,48 @@ namespace VCT
         void LoadReceiverPoints();
         void CalculateVoxelDimensions();
         void LinkPointNodes();
+        void CalculateDirectionalSkipDistances();
+        void CalculateReceiverDistances();
+        void CalculateReflectionLosses();
         void UploadBuffers();
         void GenerateDataForRayTracing();
         void CreateVoxelTexture();
+        void BuildLabelVisibility();
         void PrepareTrace(uint32_t transmitterID);
         void IncreaseDepth();
         void DecreaseDepth();
         void Transmit();
         void Propagate();
         void TraceTransmitter(uint32_t transmitterID);
+        struct Frontier;
+        void TraceBidirectional();
+        void CaptureFrontierRays(uint32_t numPaths);
+        void JoinFrontierRays(uint32_t transmitterID, const std::vector<TraceProcessingData>& forwardRays, const std::vector<Frontier>& backwardFrontiers);
+        bool IsConsistentJoin(const TraceData& forward, const TraceData& backward, const glm::vec3& txPosition, const glm::vec3& rxPosition) const;
         void CalculateDiffractionRays();
         VCTData CreateVCTData() const;
         void RetrievePaths(DeviceBuffer* deviceBuffer, uint32_t numPaths);
+        void FlushReceivedPaths(uint32_t numPaths);
+        void SelectPropagationRays(uint32_t numPaths);
+        uint32_t MergeSimilarRays(const std::vector<std::pair<float, uint32_t>>& scores);
+        struct EmissionRange;
+        void LaunchEmission(const RTPipeline& pipeline, EmissionMode mode, uint32_t first, uint32_t count);
+        Status LaunchWithOrderedEmission(const RTPipeline& pipeline, EmissionRange& range, uint32_t launchCount, uint32_t childDepth);
+        void GrowPropagationPathBuffer(uint32_t depth, uint32_t numPaths);
+        uint32_t RefineBlock(const PackedPaths& paths);
         void PostProcess(uint32_t txID, uint32_t rxID);
 
     private:
         bool m_Initialized;
         std::vector<PointNode> m_PointNodes;
         std::vector<uint2> m_IeVoxelNodeIndices;
-        std::vector<uint2> m_VoxelTextureData;
+        std::vector<uint8_t> m_VoxelFieldData;
+        std::vector<uint2> m_VoxelOctantData;
         std::vector<uint32_t> m_PerIeSubIePrimitiveCount;
         std::vector<VoxelPointData> m_VoxelPointData;
         uint32_t m_NumberOfSurfacePoints;
         uint32_t m_IePrimitiveCount;
+        uint32_t m_IeClusterCount;
         uint32_t m_SubIePrimitiveCount;
         AABB m_SceneAABB;
         std::vector<std::string> m_TxIDs;
@@ -80,7 +105,16 @@ namespace VCT
 
         DeviceBuffer m_PointNodeBuffer;
         DeviceBuffer m_IeVoxelPointNodeIndicesBuffer;
-        DeviceBuffer m_VoxelTextureDataBuffer;
+        DeviceBuffer m_VoxelFieldDataBuffer;
+        DeviceBuffer m_VoxelOctantDataBuffer;
+        std::vector<float> m_ReceiverDistances;
+        DeviceBuffer m_ReceiverDistanceBuffer;
+        DeviceBuffer m_NumDelayPrunedRaysBuffer;
+        std::vector<float> m_ReflectionLosses;
+        DeviceBuffer m_ReflectionLossBuffer;
+        DeviceBuffer m_NumPathLossPrunedRaysBuffer;
+        DeviceBuffer m_DiffractionStatisticsBuffer;
+        DeviceBuffer m_LabelVisibilityBuffer;
         DeviceBuffer m_VoxelPointDataBuffer;
         DeviceBuffer m_VoxelInfoBuffer;
 
@@ -91,6 +125,8 @@ namespace VCT
         DeviceBuffer m_IePointCountBuffer;
         DeviceBuffer m_IePrimitiveCountBuffer;
         DeviceBuffer m_IePrimitiveInfoBuffer;
+        DeviceBuffer m_IeClusterBuffer;
+        DeviceBuffer m_IeClusterCountBuffer;
 
         DeviceBuffer m_SubIePrimitiveCountBuffer;
         DeviceBuffer m_SubIePrimitivePointCountBuffer;
@@ -102,6 +138,9 @@ namespace VCT
         DeviceBuffer m_SubIePrimitiveNeighborsBuffer;
 
         DeviceBuffer m_NumReceivedPathsBuffer;
+        DeviceBuffer m_RouteTableBuffer;
+        DeviceBuffer m_NumRejectedPathsBuffer;
+        uint32_t m_RouteTableSize;
         std::vector<DeviceBuffer> m_PropPathBuffers;
         DeviceBuffer m_PropPathPointerBuffer;
         DeviceBuffer m_MaxNumPropPathBuffer;
@@ -120,6 +159,7 @@ namespace VCT
         std::vector<DiffractionEdgeSegment> m_DiffractionEdgeSegments;
 
         cudaTextureObject_t m_VoxelTexture;
+        cudaTextureObject_t m_VoxelOctantTexture;
         DeviceBuffer m_TransmitterBuffer;
         DeviceBuffer m_ReceiverBuffer;
         uint32_t m_IeCount;
@@ -129,6 +169,11 @@ namespace VCT
         DeviceBuffer m_VCTDataBuffer;
 
         DeviceBuffer m_PathProcessingDataBuffer;
+        DeviceBuffer m_EmissionDataBuffer;
+        DeviceBuffer m_EmissionCountBuffer;
+        std::vector<uint2> m_EmissionCounts;
+        DeviceBuffer m_ActiveRayDataBuffer;
+        std::vector<DeviceBuffer> m_ActiveRayIndexBuffers;
         DeviceBuffer m_TransmitIndexProcessedBuffer;
         DeviceBuffer m_VCTStatusBuffer;
         DeviceBuffer m_DepthLevelBuffer;
@@ -139,8 +184,34 @@ namespace VCT
             bool ProcessingRequired() const { return status == Status::ProcessingRequired && launchCount > 0; }
             Status status = Status::ProcessingRequired;
             uint32_t launchCount = 0;
+            int32_t activeRayList = -1;
         };
         std::vector<PropagationStatus> m_PropagationStatuses;
+        struct EmissionRange
+        {
+            glm::u64vec2 Sum(uint32_t end) const { return end > first ? headCount + offsets[end] - offsets[first + 1] : glm::u64vec2(0); }
+            uint32_t first = 0;
+            glm::u64vec2 headCount = glm::u64vec2(0);
+            std::vector<glm::u64vec2> offsets;
+        };
+        std::vector<EmissionRange> m_EmissionRanges;
+
+        DeviceBuffer m_BeamDataBuffer;
+        DeviceBuffer m_BeamCandidateBuffer;
+        DeviceBuffer m_BeamKeepBuffer;
+        std::vector<BeamCandidate> m_BeamCandidates;
+        std::vector<uint8_t> m_BeamKeep;
+        std::vector<uint32_t> m_NumBeamKeptRays;
+        uint32_t m_NumBeamPrunedRays;
+        BeamScoreFunction m_BeamScoreFunction;
+
+        struct Frontier
+        {
+            std::vector<TraceProcessingData> rays;
+            std::unordered_map<uint32_t, std::vector<uint32_t>> rayIndicesByIe;
+        };
+        bool m_CaptureFrontierRays;
+        std::vector<TraceProcessingData> m_FrontierRays;
 
         PathStorage m_CoarsePathStorage;
         PathStorage m_RefinedPathStorage;
@@ -149,6 +220,10 @@ namespace VCT
         std::future<void> m_TransferStatus;
         std::array<DeviceBuffer, 2> m_CoarsePathBuffers;
         DeviceBuffer m_ActiveBufferIndexBuffer;
+        DeviceBuffer m_PathsToRefineBuffer;
+        DeviceBuffer m_PathInteractionsToRefineBuffer;
+        DeviceBuffer m_RefinedPathsBuffer;
+        DeviceBuffer m_NumRefinedPathsBuffer;
         bool m_UseLabelHashing;
     };
 }
\ No newline at end of file
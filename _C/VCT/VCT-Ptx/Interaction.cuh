@@ -7,6 +7,8 @@
 #include "Utils.hpp"
 #include "Ray.cuh"
 #include "Propagation.cuh"
+#include "PathAllocator.cuh"
+#include "RouteTable.cuh"
 
 extern __constant__ VCT::VCTData data;
 
@@ -15,30 +17,155 @@ inline __device__ bool IsCriticalAngle(const glm::vec3& v)
 	return isnan(v.x);
 }
 
-inline __device__ bool HandleReceiverInteraction(const Ray& ray, const VCT::IntersectableEntity& ie, const VCT::TraceProcessingData& tpData)
+inline __device__ bool HandleReceiverInteraction(const Ray& ray, const VCT::IntersectableEntity& ie, const VCT::TraceProcessingData& tpData, PathAllocator& allocator)
 {
-	uint32_t recvPathIndex = atomicAdd(data.pathData.numReceivedPaths, 1);
-	bool allocSuccess = recvPathIndex < data.pathData.maxNumReceivedPaths;
+	// Backward traces start at a receiver and only produce propagation rays.
+	if (tpData.traceData.transmitterID >= data.sceneData.numTransmitters)
+		return true;
+
+	float dist = glm::length(ray.GetOrigin() - data.sceneData.receivers[ie.receiverID].position);
+	float timeDelay = tpData.traceData.timeDelay + dist * VCT::Constants::InvLightSpeedInVacuum;
+	if (data.coneTracingData.delayBound.receiverDistances && timeDelay > data.coneTracingData.delayBound.maxTimeDelay)
+		return true;
 
-	if (allocSuccess)
+	VCT::RouteEntry* routeEntry = nullptr;
+	if (!allocator.IsCounting() && !TryAcceptRoute(data.pathData.routeTable, tpData.traceData, ie.receiverID, timeDelay, routeEntry))
+		return true;
+
+	uint32_t recvPathIndex = 0;
+	bool allocSuccess = allocator.AllocateReceivedPath(recvPathIndex);
+
+	if (allocSuccess && !allocator.IsCounting())
 	{
 		VCT::TraceData& result = data.pathData.coarsePaths[*data.pathData.activeBufferIndex][recvPathIndex];
-		float dist = glm::length(ray.GetOrigin() - data.sceneData.receivers[ie.receiverID].position);
 		result = tpData.traceData;
-		result.timeDelay += dist * VCT::Constants::InvLightSpeedInVacuum;
+		result.timeDelay = timeDelay;
 		result.receiverID = ie.receiverID;
 	}
+	else if (!allocator.IsCounting())
+		ReleaseRoute(routeEntry);
+
 	return allocSuccess;
 }
 
-inline __device__ bool HandleEdgeInteraction(const Ray& ray, const VCT::IntersectableEntity& ie, const VCT::TraceProcessingData& tpData)
+inline __device__ bool PrunePathLoss(const Ray& ray, const VCT::TraceProcessingData& tpData, float reflectionLoss, PathAllocator& allocator)
+{
+	if (data.coneTracingData.pathLossBound.maxPathLoss <= 0.0f)
+		return false;
+
+	float distance = ray.GetPayload().GetDistance();
+	glm::vec3 position = ray.GetOrigin() + ray.GetDirection() * distance;
+	float pathDistance = tpData.traceData.timeDelay * VCT::Constants::LightSpeedInVacuum + distance;
+	float voxelRadius = VCT::Constants::Sqrt3 * 0.5f * data.coneTracingData.voxelWorldInfo.size;
+	if (!ExceedsPathLoss(data.coneTracingData, VCT::Utils::WorldToVoxel(position, data.coneTracingData.voxelWorldInfo), reflectionLoss, pathDistance, voxelRadius))
+		return false;
+
+	if (!allocator.IsCounting())
+		atomicAdd(data.coneTracingData.pathLossBound.numPrunedRays, 1);
+	return true;
+}
+
+constexpr uint32_t MaxDiffractionReceiverCandidates = 32;
+
+// Receivers that can lie in the cone of some ray of a diffraction fan. Count is InvalidPointIndex when more qualify than fit,
+// in which case every ray tests all receivers.
+struct DiffractionReceiverCandidates
+{
+	uint32_t count;
+	uint32_t receiverIDs[MaxDiffractionReceiverCandidates];
+};
+
+// Every fan direction makes the Keller cone angle with the edge. A receiver sphere of radius R at distance L is only in a ray cone of
+// half angle a if its direction is within a + asin(R / L) of the ray, so receivers deviating more from the Keller cone are skipped.
+inline __device__ void GatherDiffractionReceiverCandidates(const glm::vec3& voxel, const glm::vec3& forward, float cosAngle, DiffractionReceiverCandidates& candidates)
+{
+	float kellerAngle = acosf(glm::clamp(cosAngle, -1.0f, 1.0f));
+	float coneAngle = asinf(data.coneTracingData.sinDiffuseAngle);
+	float radius = data.coneTracingData.ieBoundingSphereRadius;
+	candidates.count = 0;
+	for (uint32_t rxID = 0; rxID < data.sceneData.numReceivers; ++rxID)
+	{
+		glm::vec3 toReceiver = VCT::Utils::WorldToVoxel(data.sceneData.receivers[rxID].position, data.coneTracingData.voxelWorldInfo) - voxel;
+		float distance = glm::length(toReceiver);
+		if (distance > radius)
+		{
+			float receiverAngle = acosf(glm::clamp(glm::dot(toReceiver, forward) / distance, -1.0f, 1.0f));
+			if (fabsf(receiverAngle - kellerAngle) > coneAngle + asinf(radius / distance) + 1e-3f)
+				continue;
+		}
+
+		if (candidates.count == MaxDiffractionReceiverCandidates)
+		{
+			candidates.count = VCT::Constants::InvalidPointIndex;
+			return;
+		}
+		candidates.receiverIDs[candidates.count++] = rxID;
+	}
+}
+
+inline __device__ bool CanReachReceiver(const VCT::IntersectionData& intersectionData, const DiffractionReceiverCandidates& candidates)
+{
+	bool allReceivers = candidates.count == VCT::Constants::InvalidPointIndex;
+	uint32_t count = allReceivers ? data.sceneData.numReceivers : candidates.count;
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		uint32_t rxID = allReceivers ? i : candidates.receiverIDs[i];
+		if (intersectionData.Intersect(VCT::Utils::WorldToVoxel(data.sceneData.receivers[rxID].position, data.coneTracingData.voxelWorldInfo), data.coneTracingData.ieBoundingSphereRadius, 0.0f))
+			return true;
+	}
+	return false;
+}
+
+enum class DiffractionRayStatus : uint32_t
+{
+	Emitted = 0,
+	Invalid,
+	Culled
+};
+
+inline __device__ DiffractionRayStatus BuildDiffractionRay(const VCT::DiffractionEdge& edge,
+														   const VCT::DiffractionRay& diffractionRay,
+														   const glm::mat4& mat,
+														   const glm::vec3& center,
+														   const glm::vec3& voxel,
+														   float sinAngle,
+														   const DiffractionReceiverCandidates* receiverCandidates,
+														   glm::vec3& rayDirection,
+														   VCT::IntersectionData& intersectionData)
+{
+	if (!edge.IsValidDiffractionRay(diffractionRay))
+		return DiffractionRayStatus::Invalid;
+
+	glm::vec2 direction = edge.RotateDiffractionDirection(diffractionRay.direction);
+	glm::vec2 planeDirection0 = edge.RotateDiffractionDirection(diffractionRay.planeDirections[0]);
+	glm::vec2 planeDirection1 = edge.RotateDiffractionDirection(diffractionRay.planeDirections[1]);
+	glm::vec4 translation = mat * glm::vec4(direction.x * sinAngle, 0.0f, direction.y * sinAngle, 1.0f);
+
+	glm::vec3 planeDir0 = glm::vec3(mat * glm::vec4(planeDirection0.x * sinAngle, 0.0f, planeDirection0.y * sinAngle, 1.0f)) - center;
+	glm::vec3 planeDir1 = glm::vec3(mat * glm::vec4(planeDirection1.x * sinAngle, 0.0f, planeDirection1.y * sinAngle, 1.0f)) - center;
+
+	glm::vec3 planeNormal0 = glm::normalize(glm::cross(planeDir0, edge.forward));
+	glm::vec3 planeNormal1 = glm::normalize(glm::cross(planeDir1, -edge.forward));
+
+	rayDirection = glm::normalize(glm::vec3(translation) - center);
+	intersectionData.rayCone = Cone(voxel, rayDirection, data.coneTracingData.cosDiffuseAngle, data.coneTracingData.sinDiffuseAngle);
+	intersectionData.separationPlanes[0] = Plane(voxel, planeNormal0);
+	intersectionData.separationPlanes[1] = Plane(voxel, planeNormal1);
+
+	if (receiverCandidates && !CanReachReceiver(intersectionData, *receiverCandidates))
+		return DiffractionRayStatus::Culled;
+
+	return DiffractionRayStatus::Emitted;
+}
+
+inline __device__ bool HandleEdgeInteraction(const Ray& ray, const VCT::IntersectableEntity& ie, const VCT::TraceProcessingData& tpData, PathAllocator& allocator)
 {
 	const VCT::DiffractionEdgeSegment& edgeSegment = data.coneTracingData.diffractionEdgeSegments[ie.edgeSegmentID];
 	const VCT::DiffractionEdge& edge = data.coneTracingData.diffractionEdges[edgeSegment.parentID];
 
 	glm::vec3 dir = ray.GetDirection();
 
-	if (!edge.IsValidIncidentRayForDiffraction(dir))
+	if (!edge.IsValidIncidentRayForDiffraction(dir) || PrunePathLoss(ray, tpData, tpData.reflectionLoss, allocator))
 		return true;
 
 	glm::vec3 reflectedRay = glm::reflect(dir, edge.right);
@@ -48,6 +175,7 @@ inline __device__ bool HandleEdgeInteraction(const Ray& ray, const VCT::Intersec
 
 	uint32_t index = edge.firstInfoIndex + static_cast<uint32_t>(std::abs(sinAngle) * VCT::Constants::UnitCircleDiscretizationCount);
 	glm::vec3 center = ie.rtPoint;
+	glm::vec3 voxel = VCT::Utils::WorldToVoxel(center, data.coneTracingData.voxelWorldInfo);
 
 	glm::mat4 mat = glm::mat4(glm::vec4(edge.right, 0.0f),
 							  glm::vec4(edge.forward, 0.0f),
@@ -56,30 +184,46 @@ inline __device__ bool HandleEdgeInteraction(const Ray& ray, const VCT::Intersec
 
 	uint32_t iaIndex = tpData.traceData.numInteractions;
 
+	// Child rays that can only hit receivers are dropped when no receiver lies in their cone. Receivers are traced regardless of the cone up to two interactions,
+	// and the bidirectional search turns culling off because its rays end on the frontier instead of a receiver.
+	uint32_t childNumInteractions = iaIndex + 1;
+	bool cullByReceivers = data.coneTracingData.diffractionReceiverCulling && childNumInteractions >= data.coneTracingData.maximumNumberOfInteractions &&
+		childNumInteractions > 2;
+	DiffractionReceiverCandidates receiverCandidates;
+	if (cullByReceivers)
+		GatherDiffractionReceiverCandidates(voxel, edge.forward, cosAngle, receiverCandidates);
+
 	const VCT::IndexInfo& diffIndexInfo = data.coneTracingData.diffractionIndexInfos[index];
-	uint32_t firstRay = atomicAdd(&data.pathData.pathProcessingData->numPaths, diffIndexInfo.count);
-	bool allocSuccess = firstRay + diffIndexInfo.count <= data.pathData.maxNumPropPaths[iaIndex];
+	uint32_t rayCounts[3] = { 0, 0, 0 };
+	glm::vec3 rayDirection;
+	VCT::IntersectionData intersectionData;
+	for (uint32_t rayIndex = 0; rayIndex < diffIndexInfo.count; ++rayIndex)
+	{
+		const VCT::DiffractionRay& diffractionRay = data.coneTracingData.diffractionRays[diffIndexInfo.first + rayIndex];
+		++rayCounts[static_cast<uint32_t>(BuildDiffractionRay(edge, diffractionRay, mat, center, voxel, sinAngle, cullByReceivers ? &receiverCandidates : nullptr, rayDirection, intersectionData))];
+	}
 
-	if (allocSuccess)
+	uint32_t numRays = rayCounts[static_cast<uint32_t>(DiffractionRayStatus::Emitted)];
+	uint32_t firstRay = 0;
+	bool allocSuccess = numRays == 0 || allocator.AllocatePropagationPaths(iaIndex, numRays, firstRay);
+
+	if (allocSuccess && !allocator.IsCounting())
 	{
-		atomicAdd(&data.pathData.pathProcessingData->nextNumPathsToProcess, diffIndexInfo.count);
+		VCT::DiffractionStatistics* statistics = data.coneTracingData.diffractionStatistics;
+		atomicAdd(&statistics->numEdgeHits, 1);
+		atomicAdd(&statistics->numEmittedRays, numRays);
+		atomicAdd(&statistics->numInvalidRays, rayCounts[static_cast<uint32_t>(DiffractionRayStatus::Invalid)]);
+		atomicAdd(&statistics->numCulledRays, rayCounts[static_cast<uint32_t>(DiffractionRayStatus::Culled)]);
 
 		uint32_t localRayIndex = 0;
-		for (uint32_t rayIndex = 0; rayIndex < diffIndexInfo.count; ++rayIndex)
+		for (uint32_t rayIndex = 0; rayIndex < diffIndexInfo.count && localRayIndex < numRays; ++rayIndex)
 		{
 			const VCT::DiffractionRay& diffractionRay = data.coneTracingData.diffractionRays[diffIndexInfo.first + rayIndex];
+			if (BuildDiffractionRay(edge, diffractionRay, mat, center, voxel, sinAngle, cullByReceivers ? &receiverCandidates : nullptr, rayDirection, intersectionData) != DiffractionRayStatus::Emitted)
+				continue;
 
 			VCT::PropagationData& propData = data.pathData.propPaths[iaIndex][firstRay + localRayIndex++];
 
-			glm::vec4 translation = mat * glm::vec4(diffractionRay.direction.x * sinAngle, 0.0f, diffractionRay.direction.y * sinAngle, 1.0f);
-
-			glm::vec3 planeDir0 = glm::vec3(mat * glm::vec4(diffractionRay.planeDirections[0].x * sinAngle, 0.0f, diffractionRay.planeDirections[0].y * sinAngle, 1.0f)) - center;
-			glm::vec3 planeDir1 = glm::vec3(mat * glm::vec4(diffractionRay.planeDirections[1].x * sinAngle, 0.0f, diffractionRay.planeDirections[1].y * sinAngle, 1.0f)) - center;
-
-			glm::vec3 planeNormal0 = glm::normalize(glm::cross(planeDir0, edge.forward));
-			glm::vec3 planeNormal1 = glm::normalize(glm::cross(planeDir1, -edge.forward));
-
-
 			propData.tpData = tpData;
 			propData.tpData.incidentIor = 1.0f;
 			propData.tpData.numDiffractions++;
@@ -90,42 +234,41 @@ inline __device__ bool HandleEdgeInteraction(const Ray& ray, const VCT::Intersec
 
 			propData.tpData.traceData.interactions[iaIndex].position = center;
 			propData.tpData.traceData.interactions[iaIndex].ieID = ray.GetPayload().hitIeID;
-			propData.tpData.traceData.interactions[iaIndex].label = data.coneTracingData.diffractionEdgeSegments[data.sceneData.intersectableEntities[ray.GetPayload().hitIeID].edgeSegmentID].parentID;
+			propData.tpData.traceData.interactions[iaIndex].label = edgeSegment.parentID;
 			propData.tpData.traceData.interactions[iaIndex].normal = VCT::Utils::FixNormal(ray.GetDirection(), edge.right);
 			propData.tpData.traceData.interactions[iaIndex].type = VCT::InteractionType::Diffraction;
 
 			propData.voxelTraceData.finished = false;
-			propData.voxelTraceData.rayDirection = glm::normalize(glm::vec3(translation) - center);
-			propData.voxelTraceData.voxel = VCT::Utils::WorldToVoxel(propData.tpData.traceData.interactions[iaIndex].position, data.coneTracingData.voxelWorldInfo);
+			propData.voxelTraceData.rayDirection = rayDirection;
+			propData.voxelTraceData.voxel = voxel;
 			propData.voxelTraceData.localIeID = 0;
 			propData.voxelTraceData.localVoxel = glm::u16vec3(0);
 
-			propData.voxelTraceData.previousVoxel = propData.voxelTraceData.voxel;
-			InitVoxelHistory(propData.voxelTraceData.voxelHistory);
-
-			propData.voxelTraceData.intersectionData.rayCone = Cone(propData.voxelTraceData.voxel, propData.voxelTraceData.rayDirection, data.coneTracingData.cosDiffuseAngle, data.coneTracingData.sinDiffuseAngle);
-			propData.voxelTraceData.intersectionData.separationPlanes[0] = Plane(propData.voxelTraceData.voxel, planeNormal0);
-			propData.voxelTraceData.intersectionData.separationPlanes[1] = Plane(propData.voxelTraceData.voxel, planeNormal1);
+			propData.voxelTraceData.previousVoxel = glm::vec3(VCT::Constants::InvalidVoxelCoordinate);
+			propData.voxelTraceData.intersectionData = intersectionData;
 		}
 	}
 
 	return allocSuccess;
 }
 
-inline __device__ bool HandleReflectionInteraction(const Ray& ray, const VCT::TraceProcessingData& tpData, VCT::PropagationData& result)
+inline __device__ bool HandleReflectionInteraction(const Ray& ray, const VCT::TraceProcessingData& tpData, float reflectionLoss, VCT::PropagationData& result)
 {
 	uint32_t iaIndex = tpData.traceData.numInteractions;
+	const VCT::IntersectableEntity& ie = data.sceneData.intersectableEntities[ray.GetPayload().hitIeID];
 	glm::vec3 surfaceNormal = ray.GetPayload().GetNormal();
 	glm::vec3 reflectedRay = glm::reflect(ray.GetDirection(), surfaceNormal);
 
 	result.tpData = tpData;
 	result.tpData.incidentIor = 1.0f;
+	result.tpData.reflectionLoss = reflectionLoss;
 
 	result.tpData.traceData.numInteractions++;
 	result.tpData.traceData.timeDelay += ray.GetPayload().GetDistance() * VCT::Constants::InvLightSpeedInVacuum;
 	result.tpData.traceData.interactions[iaIndex].position = ray.GetOrigin() + ray.GetDirection() * ray.GetPayload().GetDistance();
 	result.tpData.traceData.interactions[iaIndex].ieID = ray.GetPayload().hitIeID;
-	result.tpData.traceData.interactions[iaIndex].label = data.sceneData.intersectableEntities[ray.GetPayload().hitIeID].surfaceLabel;
+	result.tpData.traceData.interactions[iaIndex].label = ie.surfaceLabel;
+	result.tpData.traceData.interactions[iaIndex].materialID = ie.materialID;
 	result.tpData.traceData.interactions[iaIndex].normal = surfaceNormal;
 	result.tpData.traceData.interactions[iaIndex].type = VCT::InteractionType::Reflection;
 	
@@ -134,8 +277,7 @@ inline __device__ bool HandleReflectionInteraction(const Ray& ray, const VCT::Tr
 	result.voxelTraceData.voxel = VCT::Utils::WorldToVoxel(result.tpData.traceData.interactions[iaIndex].position, data.coneTracingData.voxelWorldInfo);
 	result.voxelTraceData.localIeID = 0;
 	result.voxelTraceData.localVoxel = glm::u16vec3(0);
-	result.voxelTraceData.previousVoxel = result.voxelTraceData.voxel;
-	InitVoxelHistory(result.voxelTraceData.voxelHistory);
+	result.voxelTraceData.previousVoxel = glm::vec3(VCT::Constants::InvalidVoxelCoordinate);
 
 	result.voxelTraceData.intersectionData.rayCone = Cone(result.voxelTraceData.voxel, result.voxelTraceData.rayDirection, data.coneTracingData.reflCosDiffuseAngle, data.coneTracingData.reflSinDiffuseAngle);
 	result.voxelTraceData.intersectionData.separationPlanes[0] = Plane(result.voxelTraceData.voxel + surfaceNormal * VCT::Constants::SeparationPlaneBias, -surfaceNormal);
@@ -144,31 +286,49 @@ inline __device__ bool HandleReflectionInteraction(const Ray& ray, const VCT::Tr
 	return true;
 }
 
-inline __device__ bool HandleSurfaceInteraction(const Ray& ray, const VCT::TraceProcessingData& tpData)
+inline __device__ bool HandleSurfaceInteraction(const Ray& ray, const VCT::TraceProcessingData& tpData, PathAllocator& allocator)
 {
-	VCT::PropagationData reflectionResult{}, refractionResult{};
-	HandleReflectionInteraction(ray, tpData, reflectionResult);
+	const VCT::PathLossBoundData& pathLossBound = data.coneTracingData.pathLossBound;
+	float reflectionLoss = tpData.reflectionLoss;
+	if (pathLossBound.maxPathLoss > 0.0f)
+	{
+		uint32_t materialID = data.sceneData.intersectableEntities[ray.GetPayload().hitIeID].materialID;
+		reflectionLoss += GetReflectionLoss(pathLossBound, materialID, glm::dot(ray.GetDirection(), ray.GetPayload().GetNormal()));
+		if (PrunePathLoss(ray, tpData, reflectionLoss, allocator))
+			return true;
+	}
+
 	uint32_t iaIndex = tpData.traceData.numInteractions;
-	bool allocSuccess = true;
 	constexpr uint32_t allocCount = 1u;
-	uint32_t propIndex = atomicAdd(&data.pathData.pathProcessingData->numPaths, allocCount);
-	allocSuccess = propIndex + allocCount <= data.pathData.maxNumPropPaths[iaIndex];
-	if (allocSuccess)
-		atomicAdd(&data.pathData.pathProcessingData->nextNumPathsToProcess, allocCount);
+	uint32_t propIndex = 0;
+	bool allocSuccess = allocator.AllocatePropagationPaths(iaIndex, allocCount, propIndex);
 
-	if (allocSuccess)
-		data.pathData.propPaths[iaIndex][propIndex] = reflectionResult;
+	if (allocSuccess && !allocator.IsCounting())
+		HandleReflectionInteraction(ray, tpData, reflectionLoss, data.pathData.propPaths[iaIndex][propIndex]);
 
 	return allocSuccess;
 }
 
-inline __device__ bool HandleValidInteraction(const Ray& ray, const VCT::IntersectableEntity& ie, const VCT::TraceProcessingData& tpData)
+inline __device__ bool HandleValidInteraction(const Ray& ray, const VCT::IntersectableEntity& ie, const VCT::TraceProcessingData& tpData, PathAllocator& allocator)
 {
+	if (ie.type != VCT::IEType::Receiver && data.coneTracingData.delayBound.receiverDistances)
+	{
+		float distance = ray.GetPayload().GetDistance();
+		glm::vec3 position = ray.GetOrigin() + ray.GetDirection() * distance;
+		float voxelRadius = VCT::Constants::Sqrt3 * 0.5f * data.coneTracingData.voxelWorldInfo.size;
+		if (ExceedsTimeDelay(data.coneTracingData, VCT::Utils::WorldToVoxel(position, data.coneTracingData.voxelWorldInfo), tpData.traceData.timeDelay, distance, voxelRadius))
+		{
+			if (!allocator.IsCounting())
+				atomicAdd(data.coneTracingData.delayBound.numPrunedRays, 1);
+			return true;
+		}
+	}
+
 	switch (ie.type) // Could be callable
 	{
-	case VCT::IEType::Receiver: return HandleReceiverInteraction(ray, ie, tpData);
-	case VCT::IEType::Edge:		return HandleEdgeInteraction(ray, ie, tpData);
-	case VCT::IEType::Surface:  return HandleSurfaceInteraction(ray, tpData);
+	case VCT::IEType::Receiver: return HandleReceiverInteraction(ray, ie, tpData, allocator);
+	case VCT::IEType::Edge:		return HandleEdgeInteraction(ray, ie, tpData, allocator);
+	case VCT::IEType::Surface:  return HandleSurfaceInteraction(ray, tpData, allocator);
 	default:					return true;
 	}
 }
\ No newline at end of file
@@ -0,0 +1,108 @@
+#pragma once
+
+#ifndef __CUDACC__
+#define __CUDACC__
+#endif
+
+#include "Types.hpp"
+
+extern __constant__ VCT::VCTData data;
+
+class PathAllocator
+{
+public:
+	__device__ PathAllocator(uint32_t launchIndex);
+	__device__ bool IsCounting() const;
+	__device__ bool AllocatePropagationPaths(uint32_t iaIndex, uint32_t count, uint32_t& firstPathIndex);
+	__device__ bool AllocateReceivedPath(uint32_t& pathIndex);
+	__device__ void StoreCounts() const;
+
+private:
+	uint32_t m_LaunchIndex;
+	VCT::EmissionMode m_Mode;
+	uint2 m_Offsets;
+	uint2 m_Counts;
+};
+
+inline __device__ PathAllocator::PathAllocator(uint32_t launchIndex)
+	: m_LaunchIndex(launchIndex)
+	, m_Mode(data.pathData.emissionData->mode)
+	, m_Offsets(make_uint2(0, 0))
+	, m_Counts(make_uint2(0, 0))
+{
+	if (m_Mode == VCT::EmissionMode::Write)
+		m_Offsets = data.pathData.emissionData->counts[launchIndex];
+}
+
+inline __device__ bool PathAllocator::IsCounting() const
+{
+	return m_Mode == VCT::EmissionMode::Count;
+}
+
+inline __device__ bool PathAllocator::AllocatePropagationPaths(uint32_t iaIndex, uint32_t count, uint32_t& firstPathIndex)
+{
+	VCT::PathProcessingData* ppData = data.pathData.pathProcessingData;
+	switch (m_Mode)
+	{
+	case VCT::EmissionMode::Count:
+	{
+		m_Counts.x += count;
+		return true;
+	}
+	case VCT::EmissionMode::Write:
+	{
+		firstPathIndex = m_Offsets.x + m_Counts.x;
+		bool allocSuccess = firstPathIndex + count <= data.pathData.maxNumPropPaths[iaIndex];
+		if (allocSuccess)
+		{
+			m_Counts.x += count;
+			atomicAdd(&ppData->numPaths, count);
+			atomicAdd(&ppData->nextNumPathsToProcess, count);
+		}
+		return allocSuccess;
+	}
+	default:
+	{
+		firstPathIndex = atomicAdd(&ppData->numPaths, count);
+		bool allocSuccess = firstPathIndex + count <= data.pathData.maxNumPropPaths[iaIndex];
+		if (allocSuccess)
+			atomicAdd(&ppData->nextNumPathsToProcess, count);
+
+		return allocSuccess;
+	}
+	}
+}
+
+inline __device__ bool PathAllocator::AllocateReceivedPath(uint32_t& pathIndex)
+{
+	switch (m_Mode)
+	{
+	case VCT::EmissionMode::Count:
+	{
+		++m_Counts.y;
+		return true;
+	}
+	case VCT::EmissionMode::Write:
+	{
+		pathIndex = m_Offsets.y + m_Counts.y;
+		bool allocSuccess = pathIndex < data.pathData.maxNumReceivedPaths;
+		if (allocSuccess)
+		{
+			++m_Counts.y;
+			atomicAdd(data.pathData.numReceivedPaths, 1);
+		}
+		return allocSuccess;
+	}
+	default:
+	{
+		pathIndex = atomicAdd(data.pathData.numReceivedPaths, 1);
+		return pathIndex < data.pathData.maxNumReceivedPaths;
+	}
+	}
+}
+
+inline __device__ void PathAllocator::StoreCounts() const
+{
+	if (IsCounting())
+		data.pathData.emissionData->counts[m_LaunchIndex] = m_Counts;
+}
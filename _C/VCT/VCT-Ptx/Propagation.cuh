@@ -21,116 +21,98 @@ inline __device__ bool IsValidInteraction(VCT::IEType ieType, const VCT::TracePr
 	return (isReceiver) || (spaceForInteraction && validInteraction);
 }
 
-template <uint32_t Size>
-inline __device__ void InitVoxelHistory(uint32_t history[Size][Size][Size])
+inline __device__ float GetReceiverDistance(const VCT::ConeTracingData& coneTracingData, const glm::vec3& voxelSpacePosition)
 {
-	#pragma unroll
-	for (uint32_t x = 0; x < Size; ++x)
-		#pragma unroll
-		for (uint32_t y = 0; y < Size; ++y)
-			#pragma unroll
-			for (uint32_t z = 0; z < Size; ++z)
-				history[x][y][z] = VCT::Constants::InvalidPointIndex;
+	const VCT::VoxelWorldInfo& vwInfo = coneTracingData.voxelWorldInfo;
+	if (!coneTracingData.delayBound.receiverDistances || glm::any(glm::lessThan(voxelSpacePosition, glm::vec3(0.0f))) || glm::any(glm::greaterThanEqual(voxelSpacePosition, glm::vec3(vwInfo.dimensions))))
+		return 0.0f;
+
+	return coneTracingData.delayBound.receiverDistances[VCT::Utils::VoxelCoordToID(glm::uvec3(voxelSpacePosition), vwInfo.dimensions)];
 }
 
-template <uint32_t Size>
-inline __device__ void CopyVoxelHistory(uint32_t dst[Size][Size][Size], uint32_t src[Size][Size][Size])
+// The delay bound in Propagate is evaluated at the traversal voxel centre c, but its break ends the whole ray. Let q be the ray point
+// closest to c, at most one voxel radius r away. Measuring the travelled and the remaining distance from c instead of q adds at most
+// 2r. The travelled plus remaining distance t + |ray(t) - rx| never decreases along the ray, so no later ray point beats q. Every point
+// the kernel of this or a later traversal voxel handles lies within 3r of that voxel's centre (1.5 voxels per axis), so within
+// 3r + r = 4r of a ray point, and it may undercut the bound by 4r on both distances. Hence 2r + 8r.
+constexpr float KernelDelaySlackInVoxelRadii = 2.0f + 2.0f * 4.0f;
+
+inline __device__ bool ExceedsTimeDelay(const VCT::ConeTracingData& coneTracingData, const glm::vec3& voxelSpacePosition, float timeDelay, float pathDistance, float distanceSlack)
 {
-	#pragma unroll
-	for (uint32_t x = 0; x < Size; ++x)
-		#pragma unroll
-		for (uint32_t y = 0; y < Size; ++y)
-			#pragma unroll
-			for (uint32_t z = 0; z < Size; ++z)
-				dst[x][y][z] = src[x][y][z];
+	const VCT::DelayBoundData& delayBound = coneTracingData.delayBound;
+	if (!delayBound.receiverDistances)
+		return false;
+
+	float receiverDistance = GetReceiverDistance(coneTracingData, voxelSpacePosition);
+	return timeDelay + glm::max(pathDistance + receiverDistance - distanceSlack, 0.0f) * VCT::Constants::InvLightSpeedInVacuum > delayBound.maxTimeDelay;
 }
 
-template <uint32_t N>
-inline __device__ void KernelFetchVoxelIDs(const glm::vec3& currentVoxelCenter, const VCT::ConeTracingData& coneTracingData, uint32_t voxels[N][N][N])
+inline __device__ float GetReflectionLoss(const VCT::PathLossBoundData& pathLossBound, uint32_t materialID, float cosIncidentAngle)
 {
-	constexpr int32_t Range = (N - 1) / 2;
-	static_assert(Range > 0, "Range out of scope.");
-
-#pragma unroll
-	for (int32_t x = -Range; x <= Range; ++x)
-#pragma unroll
-		for (int32_t y = -Range; y <= Range; ++y)
-#pragma unroll
-			for (int32_t z = -Range; z <= Range; ++z)
-				voxels[x + Range][y + Range][z + Range] = tex3D<uint2>(coneTracingData.voxelTexture, currentVoxelCenter.x + static_cast<float>(x),
-					currentVoxelCenter.y + static_cast<float>(y),
-					currentVoxelCenter.z + static_cast<float>(z)).x;
+	if (materialID >= pathLossBound.numMaterials)
+		return 0.0f;
+
+	uint32_t bin = glm::min(static_cast<uint32_t>(glm::abs(cosIncidentAngle) * VCT::Constants::ReflectionLossBinCount), VCT::Constants::ReflectionLossBinCount - 1);
+	return pathLossBound.reflectionLosses[materialID * VCT::Constants::ReflectionLossBinCount + bin];
 }
 
-template <uint32_t Size>
-inline __device__ glm::uvec3 GetLocalVoxelCoord(const glm::uvec3& centerVoxel, const glm::uvec3& voxel)
+// Lower bound of the path loss in dB: the accumulated reflection losses plus free space loss over the shortest possible path length.
+inline __device__ bool ExceedsPathLoss(const VCT::ConeTracingData& coneTracingData, const glm::vec3& voxelSpacePosition, float reflectionLoss, float pathDistance, float distanceSlack)
 {
-	static_assert(Size >= 3 && (Size - 1) % 2 == 0);
-	constexpr int32_t distToOrigin = (Size - 1) / 2;
-	glm::ivec3 diff = glm::ivec3(voxel) - glm::ivec3(centerVoxel);
-	return glm::uvec3(diff + distToOrigin);
+	const VCT::PathLossBoundData& pathLossBound = coneTracingData.pathLossBound;
+	if (pathLossBound.maxPathLoss <= 0.0f)
+		return false;
+
+	float distance = glm::max(pathDistance + GetReceiverDistance(coneTracingData, voxelSpacePosition) - distanceSlack, pathDistance);
+	float freeSpaceLoss = glm::max(20.0f * log10f(distance) + pathLossBound.freeSpaceLossOffset, 0.0f);
+	return reflectionLoss + freeSpaceLoss > pathLossBound.maxPathLoss;
 }
 
-template <uint32_t Size>
-inline __device__ bool ShouldProcessVoxel(uint32_t voxelID, const VCT::VoxelTraceData& voxelTraceData, const VCT::ConeTracingData& coneTracingData)
+inline __device__ bool IsLabelVisible(const VCT::LabelVisibilityData& labelVisibility, uint32_t fromLabel, uint32_t toLabel)
 {
-	glm::uvec3 voxelCoord = VCT::Utils::VoxelIDToCoord(voxelID, coneTracingData.voxelWorldInfo.dimensions);
-	glm::uvec3 prevVoxelCoord = voxelTraceData.previousVoxel;
+	if (!labelVisibility.visibleLabels || fromLabel >= labelVisibility.numLabels || toLabel >= labelVisibility.numLabels)
+		return true;
 
-	glm::uvec3 localCoord = GetLocalVoxelCoord<3>(prevVoxelCoord, voxelCoord);
-
-	bool inRange = localCoord.x < Size && localCoord.y < Size && localCoord.z < Size;
-	return !inRange || voxelTraceData.voxelHistory[localCoord.x][localCoord.y][localCoord.z] != voxelID;
+	uint32_t bit = fromLabel * labelVisibility.numLabels + toLabel;
+	return (labelVisibility.visibleLabels[bit >> 5] >> (bit & 31u)) & 1u;
 }
 
 template <typename VoxelHandleFunc>
 inline __device__ bool HandleKernel(VCT::PropagationData& parent,
+									VoxelHandleFunc& voxelHandleFunc,
 									const glm::vec3& rayOrigin,
-									const glm::vec3& currentVoxelCenter,
 									const VCT::IntersectionData& intersectionData,
-									const glm::uvec3& centerVoxel,
+									const glm::vec3& centerVoxel,
 									const VCT::ConeTracingData& coneTracingData)
 {
 	constexpr uint32_t kernelSize = 3;
 	constexpr uint32_t numVoxels = kernelSize * kernelSize * kernelSize;
+	constexpr float voxelBoundingSphereRadius = VCT::Constants::Sqrt3 / 2.0f;
 
-	uint32_t kernelVoxelIDs[kernelSize][kernelSize][kernelSize];
-	glm::u16vec3 start = parent.voxelTraceData.localVoxel;
+	uint32_t firstLocalVoxel = VCT::Utils::VoxelCoordToID(glm::uvec3(parent.voxelTraceData.localVoxel), glm::uvec3(kernelSize));
 	parent.voxelTraceData.localVoxel = glm::u16vec3(0);
 
-	KernelFetchVoxelIDs(currentVoxelCenter, coneTracingData, kernelVoxelIDs);
-	uint32_t nextHistoryBuffer[kernelSize][kernelSize][kernelSize];
-	InitVoxelHistory(nextHistoryBuffer);
-
 	//Unrolling this causes huge load time. PTX size increases to 5mb. 10% faster with it though.
-	for (uint32_t i = 0; i < numVoxels; ++i)
+	for (uint32_t i = firstLocalVoxel; i < numVoxels; ++i)
 	{
-		glm::u16vec3 coord = VCT::Utils::VoxelIDToCoord(i, glm::uvec3(3));
-		uint32_t voxelID = kernelVoxelIDs[coord.x][coord.y][coord.z];
-		if (voxelID != VCT::Constants::InvalidPointIndex)
-		{
-			glm::uvec3 localVoxel = GetLocalVoxelCoord<kernelSize>(centerVoxel, VCT::Utils::VoxelIDToCoord(voxelID, coneTracingData.voxelWorldInfo.dimensions));
-			nextHistoryBuffer[localVoxel.x][localVoxel.y][localVoxel.z] = voxelID;
+		glm::u16vec3 coord = VCT::Utils::VoxelIDToCoord(i, glm::uvec3(kernelSize));
+		glm::vec3 voxel = centerVoxel + glm::vec3(coord) - 1.0f;
+		glm::vec3 voxelSpaceCenter = voxel + 0.5f;
 
-			if (coord.x >= start.x && coord.y >= start.y && coord.z >= start.z)
-			{
-				start = glm::u16vec3(0);
-				const VCT::VoxelInfo& voxelInfo = coneTracingData.voxelInfos[voxelID];
+		if (VCT::Utils::IsInVoxelKernel(voxel, parent.voxelTraceData.previousVoxel) || !intersectionData.Intersect(voxelSpaceCenter, voxelBoundingSphereRadius, voxelBoundingSphereRadius))
+			continue;
 
-				constexpr float voxelBoundingSphereRadius = VCT::Constants::Sqrt3 / 2.0f;
+		uint8_t fieldData = tex3D<uint8_t>(coneTracingData.voxelTexture, voxelSpaceCenter.x, voxelSpaceCenter.y, voxelSpaceCenter.z);
+		if (!(fieldData & VCT::Constants::VoxelOccupiedBit))
+			continue;
 
-				if (ShouldProcessVoxel<kernelSize>(voxelID, parent.voxelTraceData, coneTracingData) && intersectionData.Intersect(voxelInfo.voxelSpaceCenter, voxelBoundingSphereRadius, voxelBoundingSphereRadius))
-				{
-					if (!VoxelHandleFunc()(rayOrigin, voxelInfo, intersectionData, parent))
-					{
-						parent.voxelTraceData.localVoxel = coord;
-						return false;
-					}
-				}
-			}
+		uint32_t voxelID = VCT::Utils::VoxelCoordToID(glm::uvec3(voxel), coneTracingData.voxelWorldInfo.dimensions);
+		if (!voxelHandleFunc(rayOrigin, coneTracingData.voxelInfos[voxelID], intersectionData, parent))
+		{
+			parent.voxelTraceData.localVoxel = coord;
+			return false;
 		}
 	}
-	CopyVoxelHistory(parent.voxelTraceData.voxelHistory, nextHistoryBuffer);
 	parent.voxelTraceData.previousVoxel = centerVoxel;
 	return true;
 }
@@ -138,20 +120,33 @@ inline __device__ bool HandleKernel(VCT::PropagationData& parent,
 template <typename VoxelHandleFunc>
 inline __device__ void Propagate(VCT::PropagationData& parent,
 								 const VCT::ConeTracingData& coneTracingData,
-								 //VoxelHandleFunc voxelHandleFunc,
+								 VoxelHandleFunc& voxelHandleFunc,
 								 VCT::Status& status)
 {
 	VCT::VoxelTraceData& voxelTraceData = parent.voxelTraceData;
 	const VCT::TraceData& traceData = parent.tpData.traceData;
 
 	const glm::vec3& rayOrigin = traceData.interactions[traceData.numInteractions - 1].position;
-	TextureTraverser traverser = TextureTraverser(voxelTraceData.voxel, voxelTraceData.rayDirection, coneTracingData.voxelTexture);
+	TextureTraverser traverser = TextureTraverser(voxelTraceData.voxel, voxelTraceData.rayDirection, coneTracingData.voxelTexture, coneTracingData.voxelOctantTexture);
 
+	const float voxelRadius = VCT::Constants::Sqrt3 * 0.5f * coneTracingData.voxelWorldInfo.size;
 	do
 	{
 		if (traverser.GetMarchDistance() == 1)
 		{
-			if (!HandleKernel<VoxelHandleFunc>(parent, rayOrigin, traverser.GetTextureVoxel(), parent.voxelTraceData.intersectionData, glm::uvec3(traverser.GetCurrentVoxel()), coneTracingData))//, voxelHandleFunc))
+			if (coneTracingData.delayBound.receiverDistances)
+			{
+				glm::vec3 voxelSpaceCenter = traverser.GetCurrentVoxel() + 0.5f;
+				float travelDistance = glm::length(VCT::Utils::VoxelToWorld(voxelSpaceCenter, coneTracingData.voxelWorldInfo.worldOrigin, coneTracingData.voxelWorldInfo.size) - rayOrigin);
+				if (ExceedsTimeDelay(coneTracingData, voxelSpaceCenter, traceData.timeDelay, travelDistance, KernelDelaySlackInVoxelRadii * voxelRadius))
+				{
+					if (!voxelHandleFunc.IsCounting())
+						atomicAdd(coneTracingData.delayBound.numPrunedRays, 1);
+					break;
+				}
+			}
+
+			if (!HandleKernel(parent, voxelHandleFunc, rayOrigin, parent.voxelTraceData.intersectionData, traverser.GetCurrentVoxel(), coneTracingData))
 			{
 				voxelTraceData.voxel = traverser.GetTraverseVoxel();
 				status = VCT::Status::ProcessingRequired;
@@ -27,22 +27,64 @@ extern "C" __global__ void __intersection__VCT()
 
 struct VoxelHandler
 {
+	inline __device__ VoxelHandler(PathAllocator& allocator)
+		: allocator(allocator)
+	{
+	}
+
+	inline __device__ bool IsCounting() const
+	{
+		return allocator.IsCounting();
+	}
+
 	inline __device__ bool operator()(const glm::vec3& rayOrigin, const VCT::VoxelInfo& voxelInfo, const VCT::IntersectionData& intersectionData, VCT::PropagationData& parent)
 	{
 		float ieRadius = data.coneTracingData.ieBoundingSphereRadius;
 		uint32_t startIndex = parent.voxelTraceData.localIeID;
 		parent.voxelTraceData.localIeID = 0;
-		uint32_t parentID = parent.tpData.traceData.interactions[parent.tpData.traceData.numInteractions - 1].ieID;
-		for (uint32_t localSurfaceIndex = startIndex; localSurfaceIndex < voxelInfo.ieIndexInfo.count; ++localSurfaceIndex)
+		if (IsValidInteraction(VCT::IEType::Surface, parent.tpData, data.coneTracingData))
+		{
+			for (uint32_t localClusterIndex = 0; localClusterIndex < voxelInfo.clusterIndexInfo.count; ++localClusterIndex)
+			{
+				const VCT::IECluster& cluster = data.coneTracingData.ieClusters[voxelInfo.clusterIndexInfo.first + localClusterIndex];
+				uint32_t clusterEnd = cluster.ieIndexInfo.first + cluster.ieIndexInfo.count;
+				// The test of a single-member cluster is the member's own test, so it is left to HandleIERange.
+				if (startIndex < clusterEnd && (cluster.ieIndexInfo.count == 1 || intersectionData.IntersectCluster(cluster.voxelSpaceCenter, cluster.radius, ieRadius)))
+				{
+					if (!HandleIERange(rayOrigin, voxelInfo, intersectionData, parent, max(startIndex, cluster.ieIndexInfo.first), clusterEnd))
+						return false;
+				}
+			}
+		}
+
+		if (IsValidInteraction(VCT::IEType::Edge, parent.tpData, data.coneTracingData))
+		{
+			if (!HandleIERange(rayOrigin, voxelInfo, intersectionData, parent, max(startIndex, voxelInfo.firstLocalEdgeIndex), voxelInfo.firstLocalReceiverIndex))
+				return false;
+		}
+		return HandleIERange(rayOrigin, voxelInfo, intersectionData, parent, max(startIndex, voxelInfo.firstLocalReceiverIndex), voxelInfo.ieIndexInfo.count);
+	}
+
+	inline __device__ bool HandleIERange(const glm::vec3& rayOrigin, const VCT::VoxelInfo& voxelInfo, const VCT::IntersectionData& intersectionData, VCT::PropagationData& parent, uint32_t firstLocalIndex, uint32_t endLocalIndex)
+	{
+		float ieRadius = data.coneTracingData.ieBoundingSphereRadius;
+		const VCT::Interaction& parentInteraction = parent.tpData.traceData.interactions[parent.tpData.traceData.numInteractions - 1];
+		uint32_t parentID = parentInteraction.ieID;
+		uint32_t parentLabel = parentInteraction.type == VCT::InteractionType::Reflection ? parentInteraction.label : VCT::Constants::InvalidPointIndex;
+		for (uint32_t localSurfaceIndex = firstLocalIndex; localSurfaceIndex < endLocalIndex; ++localSurfaceIndex)
 		{
 			uint32_t ieID = voxelInfo.ieIndexInfo.first + localSurfaceIndex;
 			const VCT::IntersectableEntity& ie = data.sceneData.intersectableEntities[ieID];
+			if (ie.type == VCT::IEType::Surface && !IsLabelVisible(data.coneTracingData.labelVisibility, parentLabel, ie.surfaceLabel))
+				continue;
+
+			float radius = ie.type == VCT::IEType::Edge ? data.coneTracingData.diffractionEdgeSegments[ie.edgeSegmentID].boundingRadius : ieRadius;
 			Ray ray = Ray(rayOrigin, ie.rtPoint);
-			if (parentID != ieID && IsValidInteraction(ie.type, parent.tpData, data.coneTracingData) && (intersectionData.Intersect(ie.voxelSpaceRtPoint, ieRadius, 0.0f) || SkipIntersectIE(parent, ie.type)))
+			if (parentID != ieID && (intersectionData.Intersect(ie.voxelSpaceRtPoint, radius, 0.0f) || SkipIntersectIE(parent, ie.type)))
 			{
 				if (ray.Trace(data.sceneData.rtParams, ieID, ie.type))
 				{
-					if (!HandleValidInteraction(ray, ie, parent.tpData))
+					if (!HandleValidInteraction(ray, ie, parent.tpData, allocator))
 					{
 						parent.voxelTraceData.localIeID = localSurfaceIndex;
 						return false;
@@ -52,20 +94,41 @@ struct VoxelHandler
 		}
 		return true;
 	}
+
+	PathAllocator& allocator;
 };
 extern "C" __global__ void __raygen__VCT()
 {
 	uint32_t launchIndex = optixGetLaunchIndex().x;
 	uint32_t depthLevel = *data.coneTracingData.depthLevel;
-	VCT::PropagationData& propPath = data.pathData.propPaths[depthLevel][launchIndex];
-	
-	if (!propPath.voxelTraceData.finished)
-		Propagate<VoxelHandler>(propPath, data.coneTracingData, *data.status);
+	VCT::ActiveRayData& activeRayData = *data.pathData.activeRayData;
+	uint32_t rayIndex = activeRayData.rayIndices ? activeRayData.rayIndices[launchIndex] : data.pathData.emissionData->launchOffset + launchIndex;
+	VCT::PropagationData& propPath = data.pathData.propPaths[depthLevel][rayIndex];
+	PathAllocator allocator = PathAllocator(launchIndex);
+	VoxelHandler voxelHandler = VoxelHandler(allocator);
+
+	if (allocator.IsCounting())
+	{
+		VCT::PropagationData countPath = propPath;
+		VCT::Status countStatus = VCT::Status::Finished;
+		if (!countPath.voxelTraceData.finished)
+			Propagate(countPath, data.coneTracingData, voxelHandler, countStatus);
+
+		allocator.StoreCounts();
+	}
+	else if (!propPath.voxelTraceData.finished)
+	{
+		Propagate(propPath, data.coneTracingData, voxelHandler, *data.status);
+		if (activeRayData.nextRayIndices && !propPath.voxelTraceData.finished)
+			activeRayData.nextRayIndices[atomicAdd(&activeRayData.numNextRays, 1)] = rayIndex;
+	}
 }
 
 extern "C" __global__ void __raygen__TransmitVCT()
 {
-	uint32_t ieID = optixGetLaunchIndex().x;
+	uint32_t launchIndex = optixGetLaunchIndex().x;
+	uint32_t ieID = data.pathData.emissionData->launchOffset + launchIndex;
+	PathAllocator allocator = PathAllocator(launchIndex);
 	if (!data.transmitIndexProcessed[ieID])
 	{
 		VCT::TraceProcessingData tpData{};
@@ -76,13 +139,63 @@ extern "C" __global__ void __raygen__TransmitVCT()
 		Ray ray = Ray(tx.position, ie.rtPoint);
 		if (IsValidInteraction(ie.type, tpData, data.coneTracingData) && ray.Trace(data.sceneData.rtParams, ieID, ie.type))
 		{
-			bool interactionWritten = HandleValidInteraction(ray, ie, tpData);
-			data.transmitIndexProcessed[ieID] = interactionWritten;
+			bool interactionWritten = HandleValidInteraction(ray, ie, tpData, allocator);
+			if (!allocator.IsCounting())
+			{
+				data.transmitIndexProcessed[ieID] = interactionWritten;
 
-			if (!interactionWritten)
-				*data.status = VCT::Status::ProcessingRequired;
+				if (!interactionWritten)
+					*data.status = VCT::Status::ProcessingRequired;
+			}
 		}
 	}
+	allocator.StoreCounts();
+}
+
+extern "C" __global__ void __raygen__Beam()
+{
+	uint32_t rayIndex = optixGetLaunchIndex().x;
+	const VCT::BeamData& beamData = *data.pathData.beamData;
+	VCT::PropagationData& propPath = data.pathData.propPaths[*data.coneTracingData.depthLevel][rayIndex];
+	if (beamData.mode == VCT::BeamMode::Gather)
+	{
+		const VCT::TraceData& traceData = propPath.tpData.traceData;
+		uint32_t typeHistory = 0;
+		for (uint32_t i = 0; i < traceData.numInteractions; ++i)
+			typeHistory |= (traceData.interactions[i].type == VCT::InteractionType::Diffraction) << i;
+
+		beamData.candidates[rayIndex] = { traceData.timeDelay,
+										  traceData.numInteractions,
+										  propPath.tpData.numDiffractions,
+										  traceData.interactions[traceData.numInteractions - 1].ieID,
+										  typeHistory,
+										  propPath.voxelTraceData.rayDirection };
+	}
+	else if (!beamData.keep[rayIndex])
+		propPath.voxelTraceData.finished = true;
+}
+
+extern "C" __global__ void __raygen__LabelVisibility()
+{
+	uint3 launchIndex = optixGetLaunchIndex();
+	if (launchIndex.x >= launchIndex.y)
+		return;
+
+	const VCT::LabelVisibilityData& labelVisibility = data.coneTracingData.labelVisibility;
+	uint32_t toID = labelVisibility.sampleIeIDs[launchIndex.y];
+	const VCT::IntersectableEntity& from = data.sceneData.intersectableEntities[labelVisibility.sampleIeIDs[launchIndex.x]];
+	const VCT::IntersectableEntity& to = data.sceneData.intersectableEntities[toID];
+	if (IsLabelVisible(labelVisibility, from.surfaceLabel, to.surfaceLabel))
+		return;
+
+	Ray ray = Ray(from.rtPoint, to.rtPoint);
+	if (ray.Trace(data.sceneData.rtParams, toID, VCT::IEType::Surface))
+	{
+		uint32_t bit = from.surfaceLabel * labelVisibility.numLabels + to.surfaceLabel;
+		atomicOr(&labelVisibility.visibleLabels[bit >> 5], 1u << (bit & 31u));
+		bit = to.surfaceLabel * labelVisibility.numLabels + from.surfaceLabel;
+		atomicOr(&labelVisibility.visibleLabels[bit >> 5], 1u << (bit & 31u));
+	}
 }
 
 extern "C" __global__ void __miss__Refine()
@@ -129,7 +242,8 @@ inline __device__ void FinalizePath(VCT::TraceData& result)
 
 extern "C" __global__ void __raygen__Refine()
 {
-	const VCT::TraceData& originalPath = data.pathsToRefine[optixGetLaunchIndex().x];
+	VCT::TraceData originalPath;
+	VCT::UnpackPath(data.pathsToRefine[optixGetLaunchIndex().x], data.pathInteractionsToRefine, originalPath);
 	VCT::TraceData resultPath = originalPath;
 	if (PathRefiner(data.sceneData, data.coneTracingData, originalPath).Refine(data.refineParams, resultPath))
 	{
@@ -31,6 +31,7 @@ inline __device__ void WriteSurfaces(uint32_t surfaceVoxelID, uint32_t& surfaceI
 	VCT::IntersectableEntity* ie = nullptr;
 	VCT::IEPrimitiveInfo* primitiveInfo = nullptr;
 	uint32_t label = VCT::Constants::InvalidPointIndex;
+	uint32_t materialID = VCT::Constants::InvalidPointIndex;
 	float distSq = data.ieVoxelWorldInfo.size * 2.0f;
 	distSq *= distSq;
 
@@ -99,6 +100,7 @@ inline __device__ void WriteSurfaces(uint32_t surfaceVoxelID, uint32_t& surfaceI
 
 			float cDistSq = glm::dot(point.position - world, point.position - world);
 			label = cDistSq < distSq ? node.label : label;
+			materialID = cDistSq < distSq ? node.materialID : materialID;
 			distSq = cDistSq < distSq ? cDistSq : distSq;
 			break;
 		}
@@ -119,9 +121,27 @@ inline __device__ void WriteSurfaces(uint32_t surfaceVoxelID, uint32_t& surfaceI
 		ie->rtPoint = totalPos / static_cast<float>(primitiveInfo->pointIndexInfo.count);
 		ie->voxelSpaceRtPoint = VCT::Utils::WorldToVoxel(ie->rtPoint, data.voxelWorldInfo);
 		ie->surfaceLabel = label;
+		ie->materialID = materialID;
 	}
 }
 
+inline __device__ void WriteCluster(VCT::IECluster& cluster, uint32_t firstSurfaceIndex, uint32_t surfaceIndexEnd, uint32_t firstVoxelIeIndex)
+{
+	glm::vec3 center = glm::vec3(0.0f);
+	for (uint32_t ieIndex = firstSurfaceIndex; ieIndex < surfaceIndexEnd; ++ieIndex)
+		center += data.intersectableEntities[ieIndex].voxelSpaceRtPoint;
+	center /= static_cast<float>(surfaceIndexEnd - firstSurfaceIndex);
+
+	float radiusSq = 0.0f;
+	for (uint32_t ieIndex = firstSurfaceIndex; ieIndex < surfaceIndexEnd; ++ieIndex)
+		radiusSq = max(radiusSq, VCT::Utils::DistanceSquared(center, data.intersectableEntities[ieIndex].voxelSpaceRtPoint));
+
+	cluster.voxelSpaceCenter = center;
+	cluster.radius = sqrtf(radiusSq);
+	cluster.ieIndexInfo.first = firstSurfaceIndex - firstVoxelIeIndex;
+	cluster.ieIndexInfo.count = surfaceIndexEnd - firstSurfaceIndex;
+}
+
 extern "C" __global__ void VoxelizePointCloud()
 {
 	uint32_t voxelID = threadIdx.x + blockIdx.x * blockDim.x;
@@ -138,6 +158,10 @@ extern "C" __global__ void VoxelizePointCloud()
 	voxelInfo.voxelSpaceCenter = glm::vec3(0.5f) + glm::vec3(VCT::Utils::VoxelIDToCoord(voxelID, data.voxelWorldInfo.dimensions));
 	voxelInfo.ieIndexInfo.first = atomicAdd(data.ieCount, ieTotalCount);
 	voxelInfo.ieIndexInfo.count = ieTotalCount;
+	voxelInfo.firstLocalEdgeIndex = vpData.numPrimitives;
+	voxelInfo.firstLocalReceiverIndex = vpData.numPrimitives + vpData.numEdges;
+	voxelInfo.clusterIndexInfo.count = __popc(vpData.surfaceOctantMask);
+	voxelInfo.clusterIndexInfo.first = atomicAdd(data.ieClusterCount, voxelInfo.clusterIndexInfo.count);
 	
 	uint32_t firstSurfaceIndex = voxelInfo.ieIndexInfo.first;
 	uint32_t firstPrimitiveIndex = atomicAdd(data.iePrimitiveCount, vpData.numPrimitives);
@@ -145,17 +169,30 @@ extern "C" __global__ void VoxelizePointCloud()
 	uint32_t firstEdgeIndex = voxelInfo.ieIndexInfo.first + vpData.numPrimitives;
 	uint32_t firstReceiverIndex = firstEdgeIndex + vpData.numEdges;
 
-	for (uint32_t x = 0; x < voxelFactor; ++x)
+	uint32_t clusterIndex = voxelInfo.clusterIndexInfo.first;
+	uint32_t octantSplit = VCT::Utils::GetIeVoxelOctantSplit(voxelFactor);
+	for (uint32_t octant = 0; octant < 8; ++octant)
 	{
-		for (uint32_t y = 0; y < voxelFactor; ++y)
+		glm::uvec3 upper = glm::uvec3(octant & 1u, (octant >> 1) & 1u, (octant >> 2) & 1u);
+		glm::uvec3 first = upper * octantSplit;
+		glm::uvec3 last = glm::uvec3(octantSplit) + upper * (voxelFactor - octantSplit);
+		uint32_t firstOctantSurfaceIndex = firstSurfaceIndex;
+
+		for (uint32_t x = first.x; x < last.x; ++x)
 		{
-			for (uint32_t z = 0; z < voxelFactor; ++z)
+			for (uint32_t y = first.y; y < last.y; ++y)
 			{
-				glm::uvec3 coord = ieVoxelOrigin + glm::uvec3(x, y, z);
-				uint32_t surfaceVoxelID = VCT::Utils::VoxelCoordToID(coord, data.ieVoxelWorldInfo.dimensions);
-				WriteSurfaces(surfaceVoxelID, firstSurfaceIndex, firstPrimitiveIndex, firstPointIndex, firstEdgeIndex, firstReceiverIndex);
+				for (uint32_t z = first.z; z < last.z; ++z)
+				{
+					glm::uvec3 coord = ieVoxelOrigin + glm::uvec3(x, y, z);
+					uint32_t surfaceVoxelID = VCT::Utils::VoxelCoordToID(coord, data.ieVoxelWorldInfo.dimensions);
+					WriteSurfaces(surfaceVoxelID, firstSurfaceIndex, firstPrimitiveIndex, firstPointIndex, firstEdgeIndex, firstReceiverIndex);
+				}
 			}
 		}
+
+		if (firstSurfaceIndex != firstOctantSurfaceIndex)
+			WriteCluster(data.ieClusters[clusterIndex++], firstOctantSurfaceIndex, firstSurfaceIndex, voxelInfo.ieIndexInfo.first);
 	}
 }
 
@@ -307,7 +344,7 @@ inline __device__ bool SampleX(const int3& coord, int32_t range)
 						if (currentZ >= 0 && currentZ < dimensions.z)
 						{
 							uint32_t voxelIndex = VCT::Utils::VoxelCoordToID(glm::uvec3(currentX, currentY, currentZ), dimensions);
-							if (data.voxelTextureData[voxelIndex].x != VCT::Constants::InvalidPointIndex)
+							if (data.voxelFieldData[voxelIndex] & VCT::Constants::VoxelOccupiedBit)
 								return true;
 						}
 					}
@@ -334,7 +371,7 @@ inline __device__ bool SampleY(const int3& coord, int32_t range)
 						if (currentZ >= 0 && currentZ < dimensions.z)
 						{
 							uint32_t voxelIndex = VCT::Utils::VoxelCoordToID(glm::uvec3(currentX, currentY, currentZ), dimensions);
-							if (data.voxelTextureData[voxelIndex].x != VCT::Constants::InvalidPointIndex)
+							if (data.voxelFieldData[voxelIndex] & VCT::Constants::VoxelOccupiedBit)
 								return true;
 						}
 					}
@@ -361,7 +398,7 @@ inline __device__ bool SampleZ(const int3& coord, int32_t range)
 						if (currentY >= 0 && currentY < dimensions.y)
 						{
 							uint32_t voxelIndex = VCT::Utils::VoxelCoordToID(glm::uvec3(currentX, currentY, currentZ), dimensions);
-							if (data.voxelTextureData[voxelIndex].x != VCT::Constants::InvalidPointIndex)
+							if (data.voxelFieldData[voxelIndex] & VCT::Constants::VoxelOccupiedBit)
 								return true;
 						}
 					}
@@ -378,12 +415,11 @@ extern "C" __global__ void FillTextureData()
 	if (voxelIndex < data.voxelWorldInfo.count)
 	{
 		const glm::vec3& dimensions = data.voxelWorldInfo.dimensions;
-		uint2& texData = data.voxelTextureData[voxelIndex];
-		uint32_t firstPointNode = texData.x;
+		uint8_t& fieldData = data.voxelFieldData[voxelIndex];
 		int32_t range = 1;
-		if (firstPointNode != VCT::Constants::InvalidPointIndex)
+		if (fieldData & VCT::Constants::VoxelOccupiedBit)
 		{
-			texData.y = range;
+			fieldData |= range;
 			return;
 		}
 		glm::uvec3 ucoord = VCT::Utils::VoxelIDToCoord(voxelIndex, dimensions);
@@ -408,8 +444,9 @@ extern "C" __global__ void FillTextureData()
 				range = max(max(dimensions.x, dimensions.y), dimensions.z);
 				break;
 			}
-			++range;
+			if (++range > VCT::Constants::MaximumMarchDistance)
+				break;
 		}
-		texData.y = range;
+		fieldData = static_cast<uint8_t>(min(range, static_cast<int32_t>(VCT::Constants::MaximumMarchDistance)));
 	}
 }
\ No newline at end of file
@@ -0,0 +1,112 @@
+#pragma once
+
+#ifndef __CUDACC__
+#define __CUDACC__
+#endif
+
+#include "Types.hpp"
+
+inline __device__ unsigned long long GetRouteKey(const VCT::TraceData& traceData, uint32_t receiverID)
+{
+	unsigned long long key = 0xCBF29CE484222325ull;
+	auto combine = [&key](uint32_t value)
+	{
+		key ^= value;
+		key *= 0x100000001B3ull;
+		key ^= key >> 29;
+	};
+
+	combine(traceData.transmitterID);
+	combine(receiverID);
+	for (uint32_t i = 0; i < traceData.numInteractions; ++i)
+	{
+		combine(traceData.interactions[i].label);
+		combine(static_cast<uint32_t>(traceData.interactions[i].type));
+	}
+	return key ? key : 1ull;
+}
+
+inline __device__ uint16_t GetRouteTypes(const VCT::TraceData& traceData)
+{
+	uint16_t types = 0;
+	for (uint32_t i = 0; i < traceData.numInteractions; ++i)
+		types |= static_cast<uint16_t>(static_cast<uint32_t>(traceData.interactions[i].type) << (2 * i));
+	return types;
+}
+
+inline __device__ bool IsSameRoute(const volatile VCT::RouteEntry& entry, const VCT::TraceData& traceData, uint32_t receiverID)
+{
+	if (entry.transmitterID != traceData.transmitterID || entry.receiverID != receiverID ||
+		entry.numInteractions != traceData.numInteractions || entry.types != GetRouteTypes(traceData))
+		return false;
+
+	for (uint32_t i = 0; i < traceData.numInteractions; ++i)
+		if (entry.labels[i] != traceData.interactions[i].label)
+			return false;
+	return true;
+}
+
+// Returns nullptr when the route has no entry yet that can be compared, or the probe limit is exhausted.
+// Callers admit the path in that case, so a full table only weakens the per-route cap.
+inline __device__ VCT::RouteEntry* FindRouteEntry(const VCT::RouteTable& routeTable, const VCT::TraceData& traceData, uint32_t receiverID)
+{
+	constexpr uint32_t maxProbeCount = 32;
+	unsigned long long key = GetRouteKey(traceData, receiverID);
+	uint32_t slot = static_cast<uint32_t>(key) & routeTable.mask;
+	for (uint32_t probe = 0; probe < maxProbeCount; ++probe, slot = (slot + 1) & routeTable.mask)
+	{
+		VCT::RouteEntry& entry = routeTable.entries[slot];
+		unsigned long long storedKey = atomicCAS(&entry.key, 0ull, key);
+		if (storedKey == 0ull)
+		{
+			entry.transmitterID = traceData.transmitterID;
+			entry.receiverID = receiverID;
+			entry.numInteractions = static_cast<uint16_t>(traceData.numInteractions);
+			entry.types = GetRouteTypes(traceData);
+			for (uint32_t i = 0; i < traceData.numInteractions; ++i)
+				entry.labels[i] = traceData.interactions[i].label;
+			__threadfence();
+			atomicExch(&entry.ready, 1u);
+			return &entry;
+		}
+		if (storedKey == key)
+		{
+			if (*reinterpret_cast<volatile uint32_t*>(&entry.ready) == 0u)
+				return nullptr;
+
+			__threadfence();
+			if (IsSameRoute(entry, traceData, receiverID))
+				return &entry;
+		}
+	}
+	return nullptr;
+}
+
+inline __device__ bool TryAcceptRoute(const VCT::RouteTable& routeTable, const VCT::TraceData& traceData, uint32_t receiverID, float timeDelay, VCT::RouteEntry*& entry)
+{
+	entry = routeTable.entries ? FindRouteEntry(routeTable, traceData, receiverID) : nullptr;
+	if (!entry)
+		return true;
+
+	uint32_t timeDelayBits = __float_as_uint(timeDelay);
+	if (*reinterpret_cast<volatile uint32_t*>(&entry->numPaths) >= routeTable.maxPathsPerRoute)
+	{
+		__threadfence();
+		if (timeDelayBits > *reinterpret_cast<volatile uint32_t*>(&entry->maxTimeDelay))
+		{
+			atomicAdd(routeTable.numRejectedPaths, 1);
+			entry = nullptr;
+			return false;
+		}
+	}
+	atomicMax(&entry->maxTimeDelay, timeDelayBits);
+	__threadfence();
+	atomicAdd(&entry->numPaths, 1);
+	return true;
+}
+
+inline __device__ void ReleaseRoute(VCT::RouteEntry* entry)
+{
+	if (entry)
+		atomicSub(&entry->numPaths, 1);
+}
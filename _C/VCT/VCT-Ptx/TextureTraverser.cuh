@@ -11,45 +11,48 @@
 class TextureTraverser : public VCT::VoxelTraverser
 {
 public:
-	__device__ TextureTraverser(const glm::vec3& voxelSpacePosition, const glm::vec3& rayDirection, cudaTextureObject_t voxelTexture);
+	__device__ TextureTraverser(const glm::vec3& voxelSpacePosition, const glm::vec3& rayDirection, cudaTextureObject_t voxelTexture, cudaTextureObject_t voxelOctantTexture = 0);
 
-	__device__ const uint2& GetTextureQueryResult() const;
-	__device__ uint32_t GetVoxelID() const;
+	__device__ uint32_t GetTextureQueryResult() const;
+	__device__ bool IsOccupied() const;
 	__device__ uint32_t GetMarchDistance() const;
 	__device__ uint32_t GetCurrentHits() const;
 	__device__ void Step();
 
 private:
-	__device__ uint2 QueryTexture();
+	__device__ uint32_t QueryTexture();
+	__device__ uint32_t QueryOctantMarchDistance();
 
 private:
 	cudaTextureObject_t m_VoxelTexture;
-	uint2 m_TextureQueryResult;
+	cudaTextureObject_t m_VoxelOctantTexture;
+	uint32_t m_TextureQueryResult;
 	uint32_t m_CurrentHits;
 	uint32_t m_MaxHits;
 };
 
-inline __device__ TextureTraverser::TextureTraverser(const glm::vec3& voxelSpacePosition, const glm::vec3& rayDirection, cudaTextureObject_t voxelTexture)
+inline __device__ TextureTraverser::TextureTraverser(const glm::vec3& voxelSpacePosition, const glm::vec3& rayDirection, cudaTextureObject_t voxelTexture, cudaTextureObject_t voxelOctantTexture)
 	: VCT::VoxelTraverser(voxelSpacePosition, rayDirection)
 	, m_VoxelTexture(voxelTexture)
+	, m_VoxelOctantTexture(voxelOctantTexture)
 	, m_TextureQueryResult(QueryTexture())
 {
 
 }
 
-inline __device__ const uint2& TextureTraverser::GetTextureQueryResult() const
+inline __device__ uint32_t TextureTraverser::GetTextureQueryResult() const
 {
 	return m_TextureQueryResult;
 }
 
-inline __device__ uint32_t TextureTraverser::GetVoxelID() const
+inline __device__ bool TextureTraverser::IsOccupied() const
 {
-	return m_TextureQueryResult.x;
+	return m_TextureQueryResult & VCT::Constants::VoxelOccupiedBit;
 }
 
 inline __device__ uint32_t TextureTraverser::GetMarchDistance() const
 {
-	return m_TextureQueryResult.y;
+	return m_TextureQueryResult ? m_TextureQueryResult & VCT::Constants::MaximumMarchDistance : VCT::Constants::InvalidPointIndex;
 }
 
 inline __device__ uint32_t TextureTraverser::GetCurrentHits() const
@@ -59,13 +62,26 @@ inline __device__ uint32_t TextureTraverser::GetCurrentHits() const
 
 inline __device__ void TextureTraverser::Step()
 {
-	VCT::VoxelTraverser::Step(GetMarchDistance() - 1);
+	uint32_t marchDistance = GetMarchDistance();
+	if (m_VoxelOctantTexture)
+		marchDistance = max(marchDistance, QueryOctantMarchDistance());
+
+	VCT::VoxelTraverser::Step(marchDistance - 1);
 	m_TextureQueryResult = QueryTexture();
-	m_CurrentHits += GetVoxelID() != VCT::Constants::InvalidPointIndex;
+	m_CurrentHits += IsOccupied();
+}
+
+inline __device__ uint32_t TextureTraverser::QueryTexture()
+{
+	glm::vec3 texVoxel = GetTextureVoxel();
+	return tex3D<uint8_t>(m_VoxelTexture, texVoxel.x, texVoxel.y, texVoxel.z);
 }
 
-inline __device__ uint2 TextureTraverser::QueryTexture()
+inline __device__ uint32_t TextureTraverser::QueryOctantMarchDistance()
 {
 	glm::vec3 texVoxel = GetTextureVoxel();
-	return tex3D<uint2>(m_VoxelTexture, texVoxel.x, texVoxel.y, texVoxel.z);
+	uint2 octantDistances = tex3D<uint2>(m_VoxelOctantTexture, texVoxel.x, texVoxel.y, texVoxel.z);
+	uint32_t octant = GetOctant();
+	uint32_t packedDistances = octant < 4 ? octantDistances.x : octantDistances.y;
+	return (packedDistances >> ((octant & 3u) * 8u)) & 0xFFu;
 }
\ No newline at end of file